@@ -0,0 +1,173 @@
+/*
+ * alsa_volume.c - Mirror sound card master volume on VFD icons.
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * A thread sleeps in poll() on the mixer control device and wakes up only
+ * on mixer events. Volume is quantized on the 12 volume bars (or mute
+ * icon) and an icon packet is sent only when the displayed level changes.
+ * Other icons are left untouched.
+ *
+ * Can be tried without a real card: modprobe snd-dummy, then use
+ * "hw:Dummy" as card name and play with amixer -c Dummy set Master.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+
+#include "shuttle_vfd.h"
+#include "alsa_volume.h"
+
+#define ALSA_VOLUME_MAX_FDS  8
+
+/* Global data */
+static vfd_t *alsa_vfd;
+static snd_mixer_t *alsa_mixer;
+static snd_mixer_elem_t *alsa_elem;
+static pthread_t alsa_thread;
+static int alsa_pipe[2] = { -1, -1 }; // wakes the thread up for stopping
+
+
+static unsigned long alsa_read_level(void)
+{
+  long min, max, vol;
+  int on = 1, percent = 0;
+
+  snd_mixer_selem_get_playback_volume_range(alsa_elem, &min, &max);
+  snd_mixer_selem_get_playback_volume(alsa_elem, SND_MIXER_SCHN_FRONT_LEFT, &vol);
+
+  if (snd_mixer_selem_has_playback_switch(alsa_elem))
+    snd_mixer_selem_get_playback_switch(alsa_elem, SND_MIXER_SCHN_FRONT_LEFT, &on);
+
+  if (max > min)
+    percent = (vol - min) * 100 / (max - min);
+
+  return vfd_volume_icons(on ? percent : 0);
+}
+
+
+/* Unchanged icons aren't sent again; after a failed send, vfd icons are
+ * still the old ones so the next mixer event retries. */
+static void alsa_refresh(void)
+{
+  vfd_update_icons(alsa_vfd,
+      SHUTTLE_VFD_ICON_VOL_MASK | SHUTTLE_VFD_ICON_MUTE, alsa_read_level());
+}
+
+
+static void *alsa_watcher(void *arg)
+{
+  struct pollfd fds[ALSA_VOLUME_MAX_FDS + 1];
+  unsigned short revents;
+  int n;
+
+  alsa_refresh();
+
+  for (;;) {
+    n = snd_mixer_poll_descriptors(alsa_mixer, fds + 1, ALSA_VOLUME_MAX_FDS);
+    fds[0].fd = alsa_pipe[0];
+    fds[0].events = POLLIN;
+
+    if (poll(fds, n + 1, -1) < 0)
+      continue;
+
+    if (fds[0].revents & POLLIN)
+      break;
+
+    snd_mixer_poll_descriptors_revents(alsa_mixer, fds + 1, n, &revents);
+    if (revents & (POLLERR | POLLNVAL)) {
+      fprintf(stderr, "err: mixer device gone\n");
+      break;
+    }
+
+    if (revents & POLLIN) {
+      snd_mixer_handle_events(alsa_mixer);
+      alsa_refresh();
+    }
+  }
+
+  return NULL;
+}
+
+
+int alsa_volume_start(vfd_t *vfd, const char *card, const char *name)
+{
+  snd_mixer_selem_id_t *sid;
+
+  if (snd_mixer_open(&alsa_mixer, 0) < 0) {
+    fprintf(stderr, "err: can't open mixer\n");
+    return -1;
+  }
+
+  if (snd_mixer_attach(alsa_mixer, card) < 0 ||
+      snd_mixer_selem_register(alsa_mixer, NULL, NULL) < 0 ||
+      snd_mixer_load(alsa_mixer) < 0) {
+    fprintf(stderr, "err: can't load mixer %s\n", card);
+    snd_mixer_close(alsa_mixer);
+    return -2;
+  }
+
+  snd_mixer_selem_id_alloca(&sid);
+  snd_mixer_selem_id_set_index(sid, 0);
+  snd_mixer_selem_id_set_name(sid, name);
+
+  alsa_elem = snd_mixer_find_selem(alsa_mixer, sid);
+  if (alsa_elem == NULL || !snd_mixer_selem_has_playback_volume(alsa_elem)) {
+    fprintf(stderr, "err: no playback volume control %s on %s\n", name, card);
+    snd_mixer_close(alsa_mixer);
+    return -3;
+  }
+
+  if (pipe(alsa_pipe) < 0) {
+    snd_mixer_close(alsa_mixer);
+    return -4;
+  }
+
+  alsa_vfd = vfd;
+
+  if (pthread_create(&alsa_thread, NULL, alsa_watcher, NULL) != 0) {
+    fprintf(stderr, "err: can't start mixer watcher\n");
+    close(alsa_pipe[0]);
+    close(alsa_pipe[1]);
+    alsa_pipe[0] = alsa_pipe[1] = -1;
+    snd_mixer_close(alsa_mixer);
+    return -5;
+  }
+
+  return 0;
+}
+
+
+int alsa_volume_stop(void)
+{
+  if (alsa_pipe[1] < 0)
+    return -1;
+
+  if (write(alsa_pipe[1], "q", 1) != 1)
+    fprintf(stderr, "wrn: can't wake up mixer watcher\n");
+  pthread_join(alsa_thread, NULL);
+
+  close(alsa_pipe[0]);
+  close(alsa_pipe[1]);
+  alsa_pipe[0] = alsa_pipe[1] = -1;
+
+  snd_mixer_close(alsa_mixer);
+  return 0;
+}
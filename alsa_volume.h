@@ -0,0 +1,33 @@
+/*
+ * alsa_volume.h - Mirror sound card master volume on VFD icons.
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#ifndef ALSA_VOLUME_H
+#define ALSA_VOLUME_H
+
+#include "shuttle_vfd.h"
+
+#define ALSA_VOLUME_CARD     "default"
+#define ALSA_VOLUME_ELEM     "Master"
+
+/* Prototypes */
+
+int alsa_volume_start(vfd_t *, const char *, const char *);
+int alsa_volume_stop(void);
+
+#endif /* ALSA_VOLUME_H */
@@ -0,0 +1,263 @@
+/*
+ * file_tail.c - Follow newest line of a (log) file with inotify.
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * Only bytes appended since last offset are read, and only when inotify
+ * reported a change: between writes, tail_update() costs a non-blocking
+ * read on the inotify descriptor and a stat().
+ * - truncation (copytruncate) or rewrite in place (status file): file size
+ *   below offset, or last bytes read changed, restart from 0
+ * - rotation (rename + create, or atomic replace): the directory is
+ *   watched too, old file is drained then the new one is read from 0
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "file_tail.h"
+
+#define TAIL_CHUNK_SZ   4096
+
+#define TAIL_FILE_EVENTS (IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF)
+#define TAIL_DIR_EVENTS  (IN_CREATE | IN_MOVED_TO)
+
+
+/* Returns 1 if newest line changed */
+static int tail_feed(tail_t *t, const char *buf, int n)
+{
+  int i, changed = 0;
+
+  for (i = 0; i < n; i++) {
+    if (buf[i] == '\n') {
+      if (t->partial_len > 0 && !t->skip) {
+        t->partial[t->partial_len] = 0;
+        if (strcmp(t->partial, t->line) != 0) {
+          strcpy(t->line, t->partial);
+          changed = 1;
+        }
+      }
+      t->partial_len = 0;
+      t->skip = 0;
+    } else if (buf[i] == '\r') {
+      continue;
+    } else if (t->partial_len < TAIL_LINE_SZ - 1) {
+      t->partial[t->partial_len++] = (buf[i] == '\t') ? ' ' : buf[i];
+    }
+  }
+
+  return changed;
+}
+
+
+/* Keep the last TAIL_SEEN_SZ bytes read */
+static void tail_seen(tail_t *t, const char *buf, int n)
+{
+  int keep;
+
+  if (n >= TAIL_SEEN_SZ) {
+    memcpy(t->seen, buf + n - TAIL_SEEN_SZ, TAIL_SEEN_SZ);
+    t->seen_len = TAIL_SEEN_SZ;
+    return;
+  }
+
+  keep = TAIL_SEEN_SZ - n;
+  if (keep > t->seen_len)
+    keep = t->seen_len;
+  memmove(t->seen, t->seen + t->seen_len - keep, keep);
+  memcpy(t->seen + keep, buf, n);
+  t->seen_len = keep + n;
+}
+
+
+/* File truncated, or rewritten in place (status file: new text as long as
+ * the old one or longer): the bytes before offset are not the ones read */
+static int tail_rewritten(tail_t *t, const struct stat *st)
+{
+  char buf[TAIL_SEEN_SZ];
+
+  if (st->st_size < t->offset)
+    return 1;
+  if (t->seen_len == 0)
+    return 0;
+
+  return (pread(t->file, buf, t->seen_len, t->offset - t->seen_len) !=
+      t->seen_len || memcmp(buf, t->seen, t->seen_len) != 0);
+}
+
+
+static int tail_read(tail_t *t)
+{
+  char chunk[TAIL_CHUNK_SZ];
+  struct stat st;
+  ssize_t n;
+  int changed = 0;
+
+  if (t->file < 0 || fstat(t->file, &st) < 0)
+    return 0;
+
+  if (tail_rewritten(t, &st)) {
+    fprintf(stderr, "dbg: %s truncated or rewritten\n", t->path);
+    t->offset = 0;
+    t->seen_len = 0;
+    t->partial_len = 0;
+    t->skip = 0;
+  }
+
+  while ((n = pread(t->file, chunk, TAIL_CHUNK_SZ, t->offset)) > 0) {
+    changed |= tail_feed(t, chunk, n);
+    tail_seen(t, chunk, n);
+    t->offset += n;
+  }
+
+  return changed;
+}
+
+
+/* At startup only the end of the file matters */
+static int tail_reopen(tail_t *t, int from_end)
+{
+  struct stat st;
+
+  if (t->file >= 0) {
+    close(t->file);
+    inotify_rm_watch(t->fd, t->wd);
+  }
+  t->wd = -1;
+  t->offset = 0;
+  t->seen_len = 0;
+  t->partial_len = 0;
+  t->skip = 0;
+
+  t->file = open(t->path, O_RDONLY | O_CLOEXEC);
+  if (t->file < 0)
+    return -1;
+
+  t->wd = inotify_add_watch(t->fd, t->path, TAIL_FILE_EVENTS);
+
+  if (fstat(t->file, &st) == 0) {
+    t->ino = st.st_ino;
+    if (from_end && st.st_size > TAIL_CHUNK_SZ) {
+      t->offset = st.st_size - TAIL_CHUNK_SZ;
+      t->skip = 1; // first line is incomplete
+    }
+  }
+
+  return 0;
+}
+
+
+int tail_open(tail_t *t, const char *path)
+{
+  char dir[PATH_MAX];
+  const char *p;
+
+  memset(t, 0, sizeof(tail_t));
+  t->path = path;
+  t->file = -1;
+  t->wd = -1;
+
+  p = strrchr(path, '/');
+  if (p == NULL) {
+    t->name = path;
+    strcpy(dir, ".");
+  } else {
+    t->name = p + 1;
+    snprintf(dir, sizeof(dir), "%.*s", (p == path) ? 1 : (int)(p - path), path);
+  }
+
+  t->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (t->fd < 0) {
+    fprintf(stderr, "err: inotify not available\n");
+    return -1;
+  }
+
+  t->dwd = inotify_add_watch(t->fd, dir, TAIL_DIR_EVENTS);
+  if (t->dwd < 0) {
+    fprintf(stderr, "err: can't watch directory %s\n", dir);
+    close(t->fd);
+    return -2;
+  }
+
+  if (tail_reopen(t, 1) < 0)
+    fprintf(stderr, "wrn: %s does not exist (yet)\n", path);
+  else
+    tail_read(t);
+
+  return 0;
+}
+
+
+/* Handle pending inotify events. Returns 1 if newest line changed */
+int tail_update(tail_t *t)
+{
+  char events[TAIL_CHUNK_SZ]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *e;
+  struct stat st;
+  int modified = 0, rotated = 0, changed = 0;
+  ssize_t n;
+  char *p;
+
+  while ((n = read(t->fd, events, sizeof(events))) > 0) {
+    for (p = events; p < events + n; p += sizeof(struct inotify_event) + e->len) {
+      e = (const struct inotify_event *)p;
+
+      if (e->wd == t->wd && t->wd >= 0) {
+        if (e->mask & IN_MODIFY)
+          modified = 1;
+        if (e->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
+          rotated = 1;
+      } else if (e->wd == t->dwd && e->len > 0 &&
+          strcmp(e->name, t->name) == 0) {
+        rotated = 1;
+      }
+    }
+  }
+
+  // replaced without an event we watch (new file linked over it)
+  if (!rotated && t->file >= 0 && stat(t->path, &st) == 0 &&
+      st.st_ino != t->ino)
+    rotated = 1;
+
+  // drain what was written before rotation
+  if (modified || rotated)
+    changed = tail_read(t);
+
+  if (rotated) {
+    fprintf(stderr, "dbg: %s rotated\n", t->path);
+    if (tail_reopen(t, 0) == 0)
+      changed |= tail_read(t);
+  }
+
+  return changed;
+}
+
+
+void tail_close(tail_t *t)
+{
+  if (t->file >= 0)
+    close(t->file);
+  if (t->fd >= 0)
+    close(t->fd);
+  t->file = t->fd = -1;
+}
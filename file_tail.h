@@ -0,0 +1,51 @@
+/*
+ * file_tail.h - Follow newest line of a (log) file with inotify.
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#ifndef FILE_TAIL_H
+#define FILE_TAIL_H
+
+#include <sys/types.h>
+
+#define TAIL_LINE_SZ    128
+#define TAIL_SEEN_SZ    16      // bytes kept to detect rewrites in place
+
+typedef struct {
+  const char *path;
+  const char *name;       // basename of path
+  int fd;                 // inotify descriptor
+  int wd;                 // watch on the file, -1 if not there
+  int dwd;                // watch on its directory (rotation)
+  int file;               // -1 if not there
+  ino_t ino;              // file being read
+  off_t offset;           // bytes already read
+  int seen_len;
+  char seen[TAIL_SEEN_SZ];  // last bytes read, ending at offset
+  int skip;               // discard bytes until next newline
+  int partial_len;
+  char partial[TAIL_LINE_SZ];  // incomplete last line
+  char line[TAIL_LINE_SZ];     // newest complete line
+} tail_t;
+
+/* Prototypes */
+
+int tail_open(tail_t *, const char *);
+int tail_update(tail_t *);
+void tail_close(tail_t *);
+
+#endif /* FILE_TAIL_H */
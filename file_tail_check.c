@@ -0,0 +1,109 @@
+/*
+ * file_tail_check.c - Replays file updates against file_tail (make check).
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * Each step writes the file the way a program would (append, rewrite in
+ * place, truncate, rotate), then checks the newest line seen by
+ * tail_update(). No display needed.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "file_tail.h"
+
+static char path[PATH_MAX];
+static int failures = 0;
+
+
+static void put(const char *mode, const char *text)
+{
+  FILE *f = fopen(path, mode);
+
+  if (f == NULL) {
+    perror(path);
+    exit(2);
+  }
+  fputs(text, f);
+  fclose(f);
+}
+
+
+static void check(tail_t *t, const char *what, const char *expected)
+{
+  tail_update(t);
+
+  if (strcmp(t->line, expected) == 0) {
+    fprintf(stdout, "ok   %s\n", what);
+  } else {
+    fprintf(stdout, "FAIL %s: '%s' instead of '%s'\n", what, t->line, expected);
+    failures++;
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  char dir[] = "/tmp/file_tail_check.XXXXXX", old[PATH_MAX];
+  tail_t t;
+
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 2;
+  }
+  snprintf(path, sizeof(path), "%s/status.txt", dir);
+  snprintf(old, sizeof(old), "%s/status.txt.1", dir);
+
+  put("w", "status: idle\n");
+  if (tail_open(&t, path) < 0)
+    return 2;
+  check(&t, "initial line", "status: idle");
+
+  put("w", "status: running ok\n");
+  check(&t, "rewrite in place, longer text", "status: running ok");
+
+  put("w", "status: running ko\n");
+  check(&t, "rewrite in place, same length", "status: running ko");
+
+  put("a", "partial");
+  check(&t, "incomplete line is not shown", "status: running ko");
+  put("a", " line\n");
+  check(&t, "completed line", "partial line");
+
+  put("a", "status: stopped\n");
+  check(&t, "append", "status: stopped");
+
+  put("w", "idle\n");
+  check(&t, "truncated to shorter text", "idle");
+
+  rename(path, old);
+  put("w", "rotated\n");
+  check(&t, "rotation", "rotated");
+
+  put("a", "after rotation\n");
+  check(&t, "append after rotation", "after rotation");
+
+  tail_close(&t);
+  unlink(path);
+  unlink(old);
+  rmdir(dir);
+
+  return (failures > 0) ? 1 : 0;
+}
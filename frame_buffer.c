@@ -0,0 +1,189 @@
+/*
+ * frame_buffer.c - Render-ahead double buffered text frames.
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * Two frames: the front one is owned by a sender thread, which sleeps until
+ * FB_SEND_USEC before its deadline then transmits it, so that its last
+ * text packet is written at the deadline. Meanwhile the caller renders the
+ * next frame in the back one. fb_swap() hands it over; buffers are
+ * exchanged as soon as the sender took the previous frame (it may not be
+ * sent yet). Rendering cost is no longer added to the USB time.
+ *
+ * Without sender thread (fb_start not called), fb_swap() transmits the
+ * back frame at once.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "shuttle_vfd.h"
+#include "frame_buffer.h"
+
+#define FB_LATE_USEC  10000
+
+typedef struct {
+  char text[SHUTTLE_VFD_WIDTH];
+  int clear;                // reset cursor before text
+  struct timespec due;      // CLOCK_MONOTONIC
+} fb_frame_t;
+
+/* Global data */
+static vfd_t *fb_vfd;
+static fb_frame_t fb_frames[2];
+static int fb_front = 0;    // frame owned by the sender
+static int fb_pending = 0;  // back frame is complete, waiting for the swap
+static int fb_running = 0;
+static long fb_late = 0;
+static pthread_t fb_thread;
+static pthread_mutex_t fb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fb_cond = PTHREAD_COND_INITIALIZER;
+
+
+static int fb_send(fb_frame_t *f)
+{
+  if (f->clear)
+    return vfd_display_frame(fb_vfd, f->text, SHUTTLE_VFD_WIDTH);
+  return vfd_display_text(fb_vfd, f->text, SHUTTLE_VFD_WIDTH, 0);
+}
+
+
+static void *fb_sender(void *arg)
+{
+  struct timespec now, start;
+  long long nsec;
+  fb_frame_t *f;
+
+  pthread_mutex_lock(&fb_lock);
+  for (;;) {
+    while (!fb_pending && fb_running)
+      pthread_cond_wait(&fb_cond, &fb_lock);
+    if (!fb_pending)
+      break; // stopped and drained
+
+    fb_front ^= 1;
+    fb_pending = 0;
+    f = &fb_frames[fb_front];
+    pthread_cond_broadcast(&fb_cond); // back frame is free
+    pthread_mutex_unlock(&fb_lock);
+
+    // last text packet written at the deadline
+    start = f->due;
+    nsec = start.tv_nsec - FB_SEND_USEC(f->clear) * 1000LL;
+    start.tv_sec += nsec / 1000000000;
+    start.tv_nsec = nsec % 1000000000;
+    if (start.tv_nsec < 0) {
+      start.tv_sec--;
+      start.tv_nsec += 1000000000;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &start, NULL) == EINTR);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - start.tv_sec) * 1000000LL +
+        (now.tv_nsec - start.tv_nsec) / 1000 > FB_LATE_USEC)
+      fb_late++;
+
+    fb_send(f);
+    pthread_mutex_lock(&fb_lock);
+  }
+  pthread_mutex_unlock(&fb_lock);
+
+  return NULL;
+}
+
+
+void fb_init(vfd_t *vfd)
+{
+  fb_vfd = vfd;
+}
+
+
+int fb_start(void)
+{
+  fb_pending = 0;
+  fb_late = 0;
+  fb_running = 1;
+
+  if (pthread_create(&fb_thread, NULL, fb_sender, NULL) != 0) {
+    fprintf(stderr, "err: can't start frame sender\n");
+    fb_running = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/* Last submitted frame is still sent */
+int fb_stop(void)
+{
+  if (!fb_running)
+    return -1;
+
+  pthread_mutex_lock(&fb_lock);
+  fb_running = 0;
+  pthread_cond_broadcast(&fb_cond);
+  pthread_mutex_unlock(&fb_lock);
+  pthread_join(fb_thread, NULL);
+
+  if (fb_late > 0)
+    fprintf(stderr, "dbg: %ld frame(s) sent late\n", fb_late);
+  return 0;
+}
+
+
+/* Frame to render into (SHUTTLE_VFD_WIDTH chars). Waits until the sender
+ * took the previous one. */
+char *fb_back(void)
+{
+  char *p;
+
+  pthread_mutex_lock(&fb_lock);
+  while (fb_pending)
+    pthread_cond_wait(&fb_cond, &fb_lock);
+  p = fb_frames[fb_front ^ 1].text;
+  pthread_mutex_unlock(&fb_lock);
+
+  return p;
+}
+
+
+/* Back frame is ready, show it at 'due' */
+int fb_swap(int clear, const struct timespec *due)
+{
+  fb_frame_t *f;
+
+  pthread_mutex_lock(&fb_lock);
+  f = &fb_frames[fb_front ^ 1];
+  f->clear = clear;
+  f->due = *due;
+
+  if (!fb_running) {
+    pthread_mutex_unlock(&fb_lock);
+    return fb_send(f);
+  }
+
+  fb_pending = 1;
+  pthread_cond_broadcast(&fb_cond);
+  pthread_mutex_unlock(&fb_lock);
+
+  return 0;
+}
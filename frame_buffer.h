@@ -0,0 +1,46 @@
+/*
+ * frame_buffer.h - Render-ahead double buffered text frames.
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+#include <time.h>
+
+#include "shuttle_vfd.h"
+
+/* Expected transmission time of a frame, from its first packet to its
+ * last text packet (cursor reset + 3 text packets, or 3 text packets).
+ * The sender starts that much before the deadline, so that the whole text
+ * is on the panel at the deadline. */
+#define FB_SEND_USEC(clear) \
+  (((clear) ? 3 : 2) * SHUTTLE_VFD_SUCCESS_SLEEP_USEC)
+
+/* How long before its deadline a frame is rendered: the back frame must
+ * be complete before the sender has to start (20ms left for rendering). */
+#define FB_RENDER_AHEAD_USEC  (FB_SEND_USEC(1) + 20000)
+
+/* Prototypes */
+
+void fb_init(vfd_t *);
+int fb_start(void);
+int fb_stop(void);
+char *fb_back(void);
+int fb_swap(int, const struct timespec *);
+
+#endif /* FRAME_BUFFER_H */
@@ -0,0 +1,338 @@
+/*
+ * graph.c - System activity history (cpu, network, disk) as bar graphs.
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * Each graph keeps its last GRAPH_SAMPLES samples in a fixed ring buffer,
+ * along with the glyph of each sample: a new sample renders one column,
+ * the whole history is rendered again only when the scale changes (rates
+ * are scaled on the highest sample in history, cpu load on 100%). No
+ * allocation after graph_init(), /proc files are read into a stack buffer.
+ *
+ * The panel font can't be redefined (no CGRAM command in the protocol),
+ * so columns use a ramp of increasing density characters.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "graph.h"
+
+#define GRAPH_READ_SZ   8192
+
+static const char graph_ramp[] = " .:-=+*#";
+static const char *graph_labels[] = { "cpu", "net", "dsk" };
+
+
+static long long graph_usec(const struct timespec *a, const struct timespec *b)
+{
+  return (a->tv_sec - b->tv_sec) * 1000000LL + (a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+
+static void graph_period(struct timespec *t)
+{
+  long long nsec = t->tv_nsec + GRAPH_PERIOD_USEC * 1000LL;
+
+  t->tv_sec += nsec / 1000000000;
+  t->tv_nsec = nsec % 1000000000;
+}
+
+
+/* Whole file (or its beginning) as a string. Returns length, -1 on error */
+static int graph_read(const char *path, char *buf, int sz)
+{
+  int fd, n, len = 0;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  while (len < sz - 1 && (n = read(fd, buf + len, sz - 1 - len)) > 0)
+    len += n;
+  close(fd);
+
+  buf[len] = 0;
+  return len;
+}
+
+
+/* Counters of the metric: cpu total and idle jiffies, or a byte count */
+static int graph_counters(int metric, unsigned long long c[2])
+{
+  char buf[GRAPH_READ_SZ], name[32], disk[32] = "";
+  unsigned long long v[8], rx, tx;
+  char *p, *e;
+  int i;
+
+  c[0] = c[1] = 0;
+
+  switch (metric) {
+    case GRAPH_CPU:
+      // old kernels have less fields (4 before 2.6), missing ones are 0
+      memset(v, 0, sizeof(v));
+      if (graph_read("/proc/stat", buf, sizeof(buf)) < 0 ||
+          sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &v[0],
+            &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 4)
+        return -1;
+      for (i = 0; i < 8; i++)
+        c[0] += v[i];
+      c[1] = v[3] + v[4]; // idle + iowait
+      break;
+
+    case GRAPH_NET:
+      if (graph_read("/proc/net/dev", buf, sizeof(buf)) < 0)
+        return -1;
+      for (p = buf; (e = strchr(p, '\n')) != NULL; p = e + 1) {
+        if (sscanf(p, " %31[^:]: %llu %*u %*u %*u %*u %*u %*u %*u %llu",
+              name, &rx, &tx) == 3 && strcmp(name, "lo") != 0)
+          c[0] += rx + tx;
+      }
+      break;
+
+    case GRAPH_DISK:
+      if (graph_read("/proc/diskstats", buf, sizeof(buf)) < 0)
+        return -1;
+      for (p = buf; (e = strchr(p, '\n')) != NULL; p = e + 1) {
+        if (sscanf(p, " %*u %*u %31s %*u %*u %llu %*u %*u %*u %llu",
+              name, &rx, &tx) != 3)
+          continue;
+        if (strncmp(name, "loop", 4) == 0 || strncmp(name, "ram", 3) == 0 ||
+            strncmp(name, "dm-", 3) == 0)
+          continue;
+        // partitions follow their disk (sda1, nvme0n1p1): already counted
+        if (disk[0] != 0 && strncmp(name, disk, strlen(disk)) == 0)
+          continue;
+        strcpy(disk, name);
+        c[0] += (rx + tx) * 512;
+      }
+      break;
+
+    default:
+      return -1;
+  }
+
+  return 0;
+}
+
+
+static char graph_glyph(graph_t *g, unsigned long v)
+{
+  int n = sizeof(graph_ramp) - 1;
+
+  if (v == 0 || g->scale == 0)
+    return graph_ramp[0];
+  if (v >= g->scale)
+    return graph_ramp[n - 1];
+  return graph_ramp[1 + (v * (n - 1) - 1) / g->scale];
+}
+
+
+static void graph_push(graph_t *g, unsigned long v)
+{
+  unsigned long evicted = 0, scale;
+  int i, tail, full = (g->count == GRAPH_SAMPLES);
+
+  if (full) {
+    evicted = g->ring[g->head];
+    g->head = (g->head + 1) % GRAPH_SAMPLES;
+    g->count--;
+  }
+
+  tail = (g->head + g->count) % GRAPH_SAMPLES;
+  g->ring[tail] = v;
+  g->count++;
+  g->samples++;
+
+  if (g->metric != GRAPH_CPU) {
+    scale = g->scale;
+    if (v > scale)
+      scale = v;
+    else if (full && evicted == scale) {
+      for (scale = 0, i = 0; i < GRAPH_SAMPLES; i++) {
+        if (g->ring[i] > scale)
+          scale = g->ring[i];
+      }
+    }
+
+    if (scale != g->scale) {
+      g->scale = scale;
+      for (i = 0; i < g->count; i++) {
+        tail = (g->head + i) % GRAPH_SAMPLES;
+        g->glyphs[tail] = graph_glyph(g, g->ring[tail]);
+      }
+      return;
+    }
+  }
+
+  g->glyphs[tail] = graph_glyph(g, v);
+}
+
+
+/* 4 characters: "512B", "1.2K", " 34M" */
+static void graph_human(char *s, unsigned long v)
+{
+  const char *units = "BKMG";
+  unsigned long d = 0;
+  int u = 0;
+
+  while (v >= 1000 && u < 3) {
+    d = v % 1000;
+    v /= 1000;
+    u++;
+  }
+
+  if (u > 0 && v < 10)
+    snprintf(s, 5, "%lu.%lu%c", v, d / 100, units[u]);
+  else
+    snprintf(s, 5, "%3lu%c", v, units[u]);
+}
+
+
+/* spec: cpu, net or disk, optionally followed by ",bar" */
+int graph_init(graph_t *g, const char *spec)
+{
+  static const char *names[] = { "cpu", "net", "disk" };
+  int i, len;
+
+  memset(g, 0, sizeof(graph_t));
+
+  len = strcspn(spec, ",");
+  for (i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+    if (strlen(names[i]) == len && strncmp(spec, names[i], len) == 0)
+      break;
+  }
+  if (i == sizeof(names)/sizeof(names[0])) {
+    fprintf(stderr, "err: unknown graph %.*s (cpu, net, disk)\n", len, spec);
+    return -1;
+  }
+  g->metric = i;
+
+  if (spec[len] == ',') {
+    if (strcmp(spec + len + 1, "bar") != 0) {
+      fprintf(stderr, "err: unknown graph option %s\n", spec + len + 1);
+      return -2;
+    }
+    g->bar = 1;
+  }
+
+  if (g->metric == GRAPH_CPU)
+    g->scale = 100;
+
+  if (graph_counters(g->metric, g->prev) < 0) {
+    fprintf(stderr, "err: can't read %s counters\n", names[g->metric]);
+    return -3;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &g->last);
+  g->next = g->last;
+  graph_period(&g->next);
+
+  return 0;
+}
+
+
+/* Take a sample if one is due. Returns 1 if history changed */
+int graph_sample(graph_t *g, const struct timespec *now)
+{
+  unsigned long long c[2], dt, di;
+  long long elapsed;
+  unsigned long v = 0;
+
+  if (graph_usec(now, &g->next) < 0)
+    return 0;
+
+  if (graph_counters(g->metric, c) < 0)
+    return 0;
+
+  dt = c[0] - g->prev[0];
+  elapsed = graph_usec(now, &g->last);
+
+  if (c[0] < g->prev[0]) {
+    v = 0; // counters reset
+  } else if (g->metric == GRAPH_CPU) {
+    di = c[1] - g->prev[1];
+    if (dt > 0 && di <= dt)
+      v = (dt - di) * 100 / dt;
+  } else if (elapsed > 0) {
+    v = dt * 1000000 / elapsed;
+  }
+
+  g->prev[0] = c[0];
+  g->prev[1] = c[1];
+  g->last = *now;
+
+  /* Absolute schedule, unless a whole period was missed */
+  graph_period(&g->next);
+  if (graph_usec(now, &g->next) >= 0) {
+    g->next = *now;
+    graph_period(&g->next);
+  }
+
+  graph_push(g, v);
+  return 1;
+}
+
+
+/* usec until next sample is due */
+long long graph_next(graph_t *g, const struct timespec *now)
+{
+  long long usec = graph_usec(&g->next, now);
+  return (usec > 0) ? usec : 0;
+}
+
+
+/* Last sample in percent of the scale */
+int graph_level(graph_t *g)
+{
+  unsigned long v;
+
+  if (g->count == 0 || g->scale == 0)
+    return 0;
+
+  v = g->ring[(g->head + g->count - 1) % GRAPH_SAMPLES];
+  return (v >= g->scale) ? 100 : (int)(v * 100 / g->scale);
+}
+
+
+/* GRAPH_WIDTH characters (not zero terminated): label, last value and
+ * history, newest sample on the right */
+void graph_render(graph_t *g, char *buf)
+{
+  char value[8] = "    ";
+  unsigned long v;
+  int i, pad = GRAPH_SAMPLES - g->count;
+
+  if (g->count > 0) {
+    v = g->ring[(g->head + g->count - 1) % GRAPH_SAMPLES];
+    if (g->metric == GRAPH_CPU)
+      snprintf(value, sizeof(value), "%3lu%%", v);
+    else
+      graph_human(value, v);
+  }
+
+  memcpy(buf, graph_labels[g->metric], 3);
+  buf[3] = ' ';
+  memcpy(buf + 4, value, 4);
+  buf[8] = ' ';
+
+  memset(buf + 9, (int)' ', pad);
+  for (i = 0; i < g->count; i++)
+    buf[9 + pad + i] = g->glyphs[(g->head + i) % GRAPH_SAMPLES];
+}
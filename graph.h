@@ -0,0 +1,57 @@
+/*
+ * graph.h - System activity history (cpu, network, disk) as bar graphs.
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <time.h>
+
+#define GRAPH_SAMPLES     11        // history length, one column each
+#define GRAPH_PERIOD_USEC 1000000
+#define GRAPH_WIDTH       (9 + GRAPH_SAMPLES)  // "cpu  45% " + columns
+
+enum graph_metrics {
+  GRAPH_CPU,    // busy time (%)
+  GRAPH_NET,    // bytes received + sent per second (all but loopback)
+  GRAPH_DISK    // bytes read + written per second (whole disks)
+};
+
+typedef struct {
+  int metric;
+  int bar;                      // mirror last sample on the volume icons
+  unsigned long long prev[2];   // counters at previous sample
+  struct timespec last;         // when counters were read
+  struct timespec next;         // when next sample is due
+  unsigned long ring[GRAPH_SAMPLES];
+  char glyphs[GRAPH_SAMPLES];   // ring[] already rendered at 'scale'
+  int head;                     // oldest sample
+  int count;
+  unsigned long scale;          // value of the highest glyph
+  unsigned long samples;        // total samples taken
+} graph_t;
+
+/* Prototypes */
+
+int graph_init(graph_t *, const char *);
+int graph_sample(graph_t *, const struct timespec *);
+long long graph_next(graph_t *, const struct timespec *);
+int graph_level(graph_t *);
+void graph_render(graph_t *, char *);
+
+#endif /* GRAPH_H */
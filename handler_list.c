@@ -72,3 +72,19 @@ long handler_count(list_t *t)
 {
   return t->nb;
 }
+
+int handler_remove(list_t *t, int index)
+{
+  int i;
+
+  if (index < 0 || index >= t->nb)
+    return -1;
+
+  for (i = index; i < t->nb - 1; i++)
+    memcpy(&t->slot[(t->index + i) % LIST_MAX_ELEMENTS],
+        &t->slot[(t->index + i + 1) % LIST_MAX_ELEMENTS],
+        sizeof(struct element));
+  t->nb--;
+
+  return 0;
+}
@@ -20,32 +20,90 @@
 #ifndef HANDLER_LIST_H
 #define HANDLER_LIST_H
 
+#include <time.h>
+
+#include "file_tail.h"
+#include "graph.h"
+
 #define LIST_MAX_ELEMENTS 15
 
 enum order_types {
   ORDER_HANDLER_CLOCK,
   ORDER_HANDLER_MESSAGE,
-  ORDER_HANDLER_MESSAGE_UPTIME
+  ORDER_HANDLER_MESSAGE_UPTIME,
+  ORDER_HANDLER_NOW_PLAYING,
+  ORDER_HANDLER_TAIL,
+  ORDER_HANDLER_GRAPH
+};
+
+/* Rendering state of an order (a pass is one full message, one clock...) */
+enum order_states {
+  ORDER_IDLE,       // next call starts a new pass
+  ORDER_RUNNING,
+  ORDER_PREEMPTED   // pass interrupted by a higher priority order
 };
 
+#define ORDER_PRIORITY_NORMAL   0
+#define ORDER_PRIORITY_ALERT   10
+
+/* Resumable position of a scrolling (or per page) pass */
+typedef struct {
+  long shown;               // last position displayed
+  long dropped;             // late positions skipped during this pass
+  struct timespec start;    // when the first position was due
+} handler_scroll_t;
+
 typedef struct {
   char *format;
+  int frames;               // seconds per pass (0 means 1)
+  int shown;
+  time_t last;              // second being displayed
 } handler_clock_t;
 
 typedef struct {
   char *message;
   unsigned short style;
+  handler_scroll_t scroll;
 } handler_text_t;
 
-typedef int (*handler_func)(void *);
+typedef struct {
+  char *player;             // NULL: any
+  long gen;                 // title version being displayed
+  unsigned long frame;      // panel frame counter after our last draw
+  handler_scroll_t scroll;
+} handler_player_t;
+
+typedef struct {
+  tail_t tail;
+  unsigned long frame;      // panel frame counter after our last draw
+  handler_scroll_t scroll;
+} handler_tail_t;
+
+typedef struct {
+  graph_t graph;
+  unsigned long start;      // sample count when pass started
+  unsigned long drawn;      // sample count at our last draw
+  unsigned long frame;      // panel frame counter after our last draw
+} handler_graph_t;
+
+struct element;
+
+/* Render one frame (due at vfd_due). Returns usec from this frame to the
+ * next one, 0 when pass is over */
+typedef int (*handler_func)(struct element *);
 
 typedef struct element
 {
   int command;
+  int priority; // higher preempts lower at next frame boundary
+  int state;
   handler_func cb;
   union {
     handler_clock_t clock;
     handler_text_t  text;
+    handler_player_t player;
+    handler_tail_t  tail;
+    handler_graph_t graph;
   } data;
 } handler_t;
 
@@ -65,5 +123,6 @@ struct element *handler_first(list_t *);
 struct element *handler_last(list_t *);
 struct element *handler_get(list_t *, int index);
 long handler_count(list_t *);
+int handler_remove(list_t *, int index);
 
 #endif /* HANDLER_LIST_H */
@@ -0,0 +1,462 @@
+/*
+ * mpris.c - Media player "now playing" (MPRIS over D-Bus session bus).
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * A thread subscribes to PropertiesChanged signals of the player object
+ * (/org/mpris/MediaPlayer2) and sleeps in poll() on the bus socket.
+ * Player state is fetched once with GetAll when a player shows up, then
+ * only signals are processed: no polling, no process spawning.
+ * - PlaybackStatus, Rate : play/pause/stop/rew/ff icons (sent on change)
+ * - Metadata             : "artist - title" string for the marquee order
+ *
+ * Can be tried on a private bus with any MPRIS player or a stub:
+ *   dbus-run-session -- sh -c 'stub-player & userspace-vfd --mpris'
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <dbus/dbus.h>
+
+#include "shuttle_vfd.h"
+#include "mpris.h"
+
+#define MPRIS_PREFIX      "org.mpris.MediaPlayer2."
+#define MPRIS_PATH        "/org/mpris/MediaPlayer2"
+#define MPRIS_IFACE       "org.mpris.MediaPlayer2.Player"
+#define MPRIS_TIMEOUT     1000 // ms, method calls
+#define MPRIS_FIELD_SZ    ((MPRIS_TITLE_SZ - 4) / 2) // "artist - song" fits
+
+enum mpris_status {
+  MPRIS_NONE,  // no player
+  MPRIS_STOPPED,
+  MPRIS_PLAYING,
+  MPRIS_PAUSED
+};
+
+/* Global data */
+static vfd_t *mpris_vfd;
+static DBusConnection *mpris_conn;
+static pthread_t mpris_thread;
+static int mpris_pipe[2] = { -1, -1 }; // wakes the thread up for stopping
+static mpris_callback mpris_changed;
+
+static const char *mpris_wanted;      // player name suffix, NULL: any
+static char mpris_owner[128];         // unique bus name of followed player
+
+static int mpris_status = MPRIS_NONE;
+static double mpris_rate = 1.0;
+static char mpris_artist[MPRIS_FIELD_SZ];
+static char mpris_song[MPRIS_FIELD_SZ];
+
+/* Read by the display, protected by lock */
+static pthread_mutex_t mpris_lock = PTHREAD_MUTEX_INITIALIZER;
+static char mpris_title[MPRIS_TITLE_SZ];
+static long mpris_gen = 0;
+
+
+/* Copy current title. Returns a counter incremented on every change */
+long mpris_get_title(char *buf, int size)
+{
+  long gen;
+
+  pthread_mutex_lock(&mpris_lock);
+  strncpy(buf, mpris_title, size - 1);
+  buf[size - 1] = 0;
+  gen = mpris_gen;
+  pthread_mutex_unlock(&mpris_lock);
+
+  return gen;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void mpris_update(void)
+{
+  unsigned long icons = 0;
+  char title[MPRIS_TITLE_SZ];
+  int changed = 0;
+
+  switch (mpris_status) {
+    case MPRIS_PLAYING:
+      icons = SHUTTLE_VFD_ICON_PLAY;
+      if (mpris_rate > 1.0)
+        icons |= SHUTTLE_VFD_ICON_FASTFORWARD;
+      else if (mpris_rate < 0.0)
+        icons |= SHUTTLE_VFD_ICON_REWIND;
+      break;
+    case MPRIS_PAUSED:
+      icons = SHUTTLE_VFD_ICON_PAUSE;
+      break;
+    case MPRIS_STOPPED:
+      icons = SHUTTLE_VFD_ICON_STOP;
+      break;
+  }
+
+  // only sent when different from what is displayed
+  vfd_update_icons(mpris_vfd, MPRIS_ICONS, icons);
+
+  if (mpris_status == MPRIS_PLAYING || mpris_status == MPRIS_PAUSED) {
+    if (mpris_artist[0] != 0)
+      snprintf(title, sizeof(title), "%s - %s", mpris_artist, mpris_song);
+    else
+      snprintf(title, sizeof(title), "%s", mpris_song);
+  } else {
+    title[0] = 0;
+  }
+
+  pthread_mutex_lock(&mpris_lock);
+  if (strcmp(title, mpris_title) != 0) {
+    strcpy(mpris_title, title);
+    mpris_gen++;
+    changed = 1;
+  }
+  pthread_mutex_unlock(&mpris_lock);
+
+  if (changed && mpris_changed != NULL)
+    mpris_changed();
+}
+
+
+static void mpris_parse_metadata(DBusMessageIter *dict)
+{
+  DBusMessageIter entry, var, list;
+  const char *key, *value;
+
+  mpris_artist[0] = 0;
+  mpris_song[0] = 0;
+
+  while (dbus_message_iter_get_arg_type(dict) == DBUS_TYPE_DICT_ENTRY) {
+    dbus_message_iter_recurse(dict, &entry);
+    dbus_message_iter_get_basic(&entry, &key);
+    dbus_message_iter_next(&entry);
+    dbus_message_iter_recurse(&entry, &var);
+
+    if (strcmp(key, "xesam:title") == 0 &&
+        dbus_message_iter_get_arg_type(&var) == DBUS_TYPE_STRING) {
+      dbus_message_iter_get_basic(&var, &value);
+      snprintf(mpris_song, sizeof(mpris_song), "%s", value);
+    } else if (strcmp(key, "xesam:artist") == 0 &&
+        dbus_message_iter_get_arg_type(&var) == DBUS_TYPE_ARRAY) {
+      // list of artists, keep the first one
+      dbus_message_iter_recurse(&var, &list);
+      if (dbus_message_iter_get_arg_type(&list) == DBUS_TYPE_STRING) {
+        dbus_message_iter_get_basic(&list, &value);
+        snprintf(mpris_artist, sizeof(mpris_artist), "%s", value);
+      }
+    }
+
+    dbus_message_iter_next(dict);
+  }
+}
+
+
+/* Iterator is on a a{sv} array content */
+static void mpris_parse_props(DBusMessageIter *dict)
+{
+  DBusMessageIter entry, var, sub;
+  const char *key, *value;
+
+  while (dbus_message_iter_get_arg_type(dict) == DBUS_TYPE_DICT_ENTRY) {
+    dbus_message_iter_recurse(dict, &entry);
+    dbus_message_iter_get_basic(&entry, &key);
+    dbus_message_iter_next(&entry);
+    dbus_message_iter_recurse(&entry, &var);
+
+    if (strcmp(key, "PlaybackStatus") == 0 &&
+        dbus_message_iter_get_arg_type(&var) == DBUS_TYPE_STRING) {
+      dbus_message_iter_get_basic(&var, &value);
+      if (strcmp(value, "Playing") == 0)
+        mpris_status = MPRIS_PLAYING;
+      else if (strcmp(value, "Paused") == 0)
+        mpris_status = MPRIS_PAUSED;
+      else
+        mpris_status = MPRIS_STOPPED;
+    } else if (strcmp(key, "Rate") == 0 &&
+        dbus_message_iter_get_arg_type(&var) == DBUS_TYPE_DOUBLE) {
+      dbus_message_iter_get_basic(&var, &mpris_rate);
+    } else if (strcmp(key, "Metadata") == 0 &&
+        dbus_message_iter_get_arg_type(&var) == DBUS_TYPE_ARRAY) {
+      dbus_message_iter_recurse(&var, &sub);
+      mpris_parse_metadata(&sub);
+    }
+
+    dbus_message_iter_next(dict);
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static DBusMessage *mpris_call(const char *dest, const char *path,
+    const char *iface, const char *method, const char *arg)
+{
+  DBusMessage *msg, *reply;
+  DBusError err;
+
+  msg = dbus_message_new_method_call(dest, path, iface, method);
+  if (msg == NULL)
+    return NULL;
+  if (arg != NULL)
+    dbus_message_append_args(msg, DBUS_TYPE_STRING, &arg, DBUS_TYPE_INVALID);
+
+  dbus_error_init(&err);
+  reply = dbus_connection_send_with_reply_and_block(mpris_conn, msg,
+      MPRIS_TIMEOUT, &err);
+  dbus_message_unref(msg);
+
+  if (dbus_error_is_set(&err)) {
+    fprintf(stderr, "wrn: %s: %s\n", method, err.message);
+    dbus_error_free(&err);
+    return NULL;
+  }
+  return reply;
+}
+
+
+static int mpris_is_wanted(const char *name)
+{
+  if (strncmp(name, MPRIS_PREFIX, strlen(MPRIS_PREFIX)) != 0)
+    return 0;
+  return (mpris_wanted == NULL ||
+      strcmp(name + strlen(MPRIS_PREFIX), mpris_wanted) == 0);
+}
+
+
+/* Follow this player: fetch its whole state once */
+static void mpris_follow(const char *name, const char *owner)
+{
+  DBusMessage *reply;
+  DBusMessageIter it, dict;
+  const char *iface = MPRIS_IFACE;
+
+  snprintf(mpris_owner, sizeof(mpris_owner), "%s", owner);
+  fprintf(stderr, "dbg: following player %s\n", name);
+
+  reply = mpris_call(name, MPRIS_PATH, "org.freedesktop.DBus.Properties",
+      "GetAll", iface);
+  if (reply == NULL)
+    return;
+
+  if (dbus_message_iter_init(reply, &it) &&
+      dbus_message_iter_get_arg_type(&it) == DBUS_TYPE_ARRAY) {
+    dbus_message_iter_recurse(&it, &dict);
+    mpris_parse_props(&dict);
+    mpris_update();
+  }
+  dbus_message_unref(reply);
+}
+
+
+/* Look for an already running player */
+static void mpris_find_player(void)
+{
+  DBusMessage *reply, *owner;
+  DBusMessageIter it, list;
+  const char *name, *unique;
+
+  reply = mpris_call("org.freedesktop.DBus", "/org/freedesktop/DBus",
+      "org.freedesktop.DBus", "ListNames", NULL);
+  if (reply == NULL)
+    return;
+
+  if (dbus_message_iter_init(reply, &it) &&
+      dbus_message_iter_get_arg_type(&it) == DBUS_TYPE_ARRAY) {
+    dbus_message_iter_recurse(&it, &list);
+    while (dbus_message_iter_get_arg_type(&list) == DBUS_TYPE_STRING) {
+      dbus_message_iter_get_basic(&list, &name);
+      if (mpris_is_wanted(name)) {
+        owner = mpris_call("org.freedesktop.DBus", "/org/freedesktop/DBus",
+            "org.freedesktop.DBus", "GetNameOwner", name);
+        if (owner != NULL) {
+          if (dbus_message_get_args(owner, NULL, DBUS_TYPE_STRING, &unique,
+                DBUS_TYPE_INVALID))
+            mpris_follow(name, unique);
+          dbus_message_unref(owner);
+          break;
+        }
+      }
+      dbus_message_iter_next(&list);
+    }
+  }
+  dbus_message_unref(reply);
+}
+
+
+static DBusHandlerResult mpris_filter(DBusConnection *conn, DBusMessage *msg,
+    void *data)
+{
+  DBusMessageIter it, dict;
+  const char *name, *old_owner, *new_owner;
+
+  if (dbus_message_is_signal(msg, "org.freedesktop.DBus.Properties",
+        "PropertiesChanged")) {
+    // ignore other players
+    if (mpris_owner[0] == 0 ||
+        strcmp(dbus_message_get_sender(msg), mpris_owner) != 0)
+      return DBUS_HANDLER_RESULT_HANDLED;
+
+    // (s interface, a{sv} changed, as invalidated)
+    if (dbus_message_iter_init(msg, &it) &&
+        dbus_message_iter_next(&it) &&
+        dbus_message_iter_get_arg_type(&it) == DBUS_TYPE_ARRAY) {
+      dbus_message_iter_recurse(&it, &dict);
+      mpris_parse_props(&dict);
+      mpris_update();
+    }
+    return DBUS_HANDLER_RESULT_HANDLED;
+  }
+
+  if (dbus_message_is_signal(msg, "org.freedesktop.DBus", "NameOwnerChanged")) {
+    if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &name,
+          DBUS_TYPE_STRING, &old_owner, DBUS_TYPE_STRING, &new_owner,
+          DBUS_TYPE_INVALID) || !mpris_is_wanted(name))
+      return DBUS_HANDLER_RESULT_HANDLED;
+
+    if (new_owner[0] == 0) {
+      if (strcmp(old_owner, mpris_owner) == 0) {
+        fprintf(stderr, "dbg: player %s is gone\n", name);
+        mpris_owner[0] = 0;
+        mpris_status = MPRIS_NONE;
+        mpris_update();
+        // another player may be running already: it won't signal again
+        mpris_find_player();
+      }
+    } else if (mpris_owner[0] == 0) {
+      mpris_follow(name, new_owner);
+    }
+    return DBUS_HANDLER_RESULT_HANDLED;
+  }
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+
+static void *mpris_watcher(void *arg)
+{
+  struct pollfd fds[2];
+  int fd;
+
+  mpris_find_player();
+
+  dbus_connection_get_unix_fd(mpris_conn, &fd);
+  fds[0].fd = mpris_pipe[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = fd;
+  fds[1].events = POLLIN;
+
+  for (;;) {
+    // messages may already be queued (received during method calls)
+    while (dbus_connection_dispatch(mpris_conn) == DBUS_DISPATCH_DATA_REMAINS)
+      ;
+
+    if (poll(fds, 2, -1) < 0)
+      continue;
+
+    if (fds[0].revents & POLLIN)
+      break;
+
+    if (fds[1].revents & (POLLERR | POLLHUP)) {
+      fprintf(stderr, "err: session bus connection lost\n");
+      break;
+    }
+
+    if (!dbus_connection_read_write(mpris_conn, 0))
+      break;
+  }
+
+  return NULL;
+}
+
+
+int mpris_start(vfd_t *vfd, const char *player, mpris_callback cb)
+{
+  DBusError err;
+
+  dbus_threads_init_default();
+  dbus_error_init(&err);
+
+  mpris_conn = dbus_bus_get_private(DBUS_BUS_SESSION, &err);
+  if (mpris_conn == NULL) {
+    fprintf(stderr, "err: can't connect to session bus: %s\n", err.message);
+    dbus_error_free(&err);
+    return -1;
+  }
+  dbus_connection_set_exit_on_disconnect(mpris_conn, FALSE);
+
+  dbus_bus_add_match(mpris_conn,
+      "type='signal',interface='org.freedesktop.DBus.Properties',"
+      "member='PropertiesChanged',path='" MPRIS_PATH "',"
+      "arg0='" MPRIS_IFACE "'", &err);
+  if (!dbus_error_is_set(&err))
+    dbus_bus_add_match(mpris_conn,
+        "type='signal',sender='org.freedesktop.DBus',"
+        "member='NameOwnerChanged',arg0namespace='org.mpris.MediaPlayer2'",
+        &err);
+  if (dbus_error_is_set(&err)) {
+    fprintf(stderr, "err: D-Bus match: %s\n", err.message);
+    dbus_error_free(&err);
+    dbus_connection_close(mpris_conn);
+    dbus_connection_unref(mpris_conn);
+    return -2;
+  }
+
+  dbus_connection_add_filter(mpris_conn, mpris_filter, NULL, NULL);
+
+  if (pipe(mpris_pipe) < 0) {
+    dbus_connection_close(mpris_conn);
+    dbus_connection_unref(mpris_conn);
+    return -3;
+  }
+
+  mpris_vfd = vfd;
+  mpris_wanted = player;
+  mpris_changed = cb;
+
+  if (pthread_create(&mpris_thread, NULL, mpris_watcher, NULL) != 0) {
+    fprintf(stderr, "err: can't start MPRIS watcher\n");
+    close(mpris_pipe[0]);
+    close(mpris_pipe[1]);
+    mpris_pipe[0] = mpris_pipe[1] = -1;
+    dbus_connection_close(mpris_conn);
+    dbus_connection_unref(mpris_conn);
+    return -4;
+  }
+
+  return 0;
+}
+
+
+int mpris_stop(void)
+{
+  if (mpris_pipe[1] < 0)
+    return -1;
+
+  if (write(mpris_pipe[1], "q", 1) != 1)
+    fprintf(stderr, "wrn: can't wake up MPRIS watcher\n");
+  pthread_join(mpris_thread, NULL);
+
+  close(mpris_pipe[0]);
+  close(mpris_pipe[1]);
+  mpris_pipe[0] = mpris_pipe[1] = -1;
+
+  dbus_connection_close(mpris_conn);
+  dbus_connection_unref(mpris_conn);
+  return 0;
+}
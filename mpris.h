@@ -0,0 +1,40 @@
+/*
+ * mpris.h - Media player "now playing" (MPRIS over D-Bus session bus).
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#ifndef MPRIS_H
+#define MPRIS_H
+
+#include "shuttle_vfd.h"
+
+#define MPRIS_TITLE_SZ    128
+
+#define MPRIS_ICONS (SHUTTLE_VFD_ICON_PLAY | SHUTTLE_VFD_ICON_PAUSE | \
+    SHUTTLE_VFD_ICON_STOP | SHUTTLE_VFD_ICON_REWIND | \
+    SHUTTLE_VFD_ICON_FASTFORWARD)
+
+/* Called from the D-Bus thread when title changed */
+typedef void (*mpris_callback)(void);
+
+/* Prototypes */
+
+int mpris_start(vfd_t *, const char *, mpris_callback);
+int mpris_stop(void);
+long mpris_get_title(char *, int);
+
+#endif /* MPRIS_H */
@@ -0,0 +1,462 @@
+/*
+ * shuttle_ir.c - IR receiver (remote control) input path.
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * The IR receiver is the HID interface (0) of the VFD device. Every key
+ * press sends a SHUTTLE_IR_REPORT_SIZE bytes report on the interrupt
+ * endpoint, an all-zero report is sent on key release.
+ * - 4 bytes : scancode (big endian)
+ * - 2 bytes : unused
+ *
+ * Reports are read by a dedicated thread (interrupt endpoint, so it never
+ * waits behind display control messages) and dispatched immediately:
+ * first to the uinput virtual keyboard, then to registered callbacks.
+ *
+ * Transport is abstracted so that recorded reports can be replayed
+ * without hardware. Replay file format, one report per line:
+ *   <delay ms> <hex byte> <hex byte> ...
+ * Lines starting with '#' are ignored.
+ *
+ * Keymap file format, one key per line:
+ *   <hex scancode> <KEY_name or decimal keycode>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include "shuttle_vfd.h"
+#include "shuttle_ir.h"
+
+#define IR_KEYMAP_SIZE      48
+
+struct ir_key {
+  unsigned long scancode;
+  int keycode;
+};
+
+struct ir_replay {
+  FILE *fp;
+  int loaded;
+  long delay;    // ms left before the loaded report is delivered
+  int len;
+  unsigned char report[SHUTTLE_IR_REPORT_SIZE];
+};
+
+/* Keymap (scancode is the report first 4 bytes). Empty by default: the
+ * codes sent by Shuttle remotes are not documented, use ir_load_keymap().
+ * Unknown scancodes are logged, so a map can be written from --ir output. */
+static struct ir_key ir_keymap[IR_KEYMAP_SIZE];
+static int ir_keymap_nb = 0;
+
+/* Key names accepted in keymap files (others: numeric keycode) */
+static const struct {
+  const char *name;
+  int keycode;
+} ir_key_names[] = {
+  { "KEY_POWER", KEY_POWER },
+  { "KEY_0", KEY_0 }, { "KEY_1", KEY_1 }, { "KEY_2", KEY_2 },
+  { "KEY_3", KEY_3 }, { "KEY_4", KEY_4 }, { "KEY_5", KEY_5 },
+  { "KEY_6", KEY_6 }, { "KEY_7", KEY_7 }, { "KEY_8", KEY_8 },
+  { "KEY_9", KEY_9 },
+  { "KEY_UP", KEY_UP },
+  { "KEY_DOWN", KEY_DOWN },
+  { "KEY_LEFT", KEY_LEFT },
+  { "KEY_RIGHT", KEY_RIGHT },
+  { "KEY_OK", KEY_OK },
+  { "KEY_BACK", KEY_BACK },
+  { "KEY_MENU", KEY_MENU },
+  { "KEY_PLAYPAUSE", KEY_PLAYPAUSE },
+  { "KEY_STOP", KEY_STOP },
+  { "KEY_REWIND", KEY_REWIND },
+  { "KEY_FASTFORWARD", KEY_FASTFORWARD },
+  { "KEY_PREVIOUS", KEY_PREVIOUS },
+  { "KEY_NEXT", KEY_NEXT },
+  { "KEY_RECORD", KEY_RECORD },
+  { "KEY_VOLUMEUP", KEY_VOLUMEUP },
+  { "KEY_VOLUMEDOWN", KEY_VOLUMEDOWN },
+  { "KEY_MUTE", KEY_MUTE },
+  { "KEY_CHANNELUP", KEY_CHANNELUP },
+  { "KEY_CHANNELDOWN", KEY_CHANNELDOWN }
+};
+
+/* Global data */
+static struct {
+  ir_callback cb;
+  void *data;
+} ir_callbacks[SHUTTLE_IR_MAX_CALLBACKS];
+static int ir_callbacks_nb = 0;
+
+static ir_transport_t ir_transport;
+static struct ir_replay ir_replay;
+static pthread_t ir_thread;
+static volatile int ir_running = 0;
+static volatile int ir_reading = 0;  // reader thread alive
+static int ir_uinput_fd = -1;
+
+
+/* ------------------------------------------------------------------------- */
+
+static int usb_read(void *ctx, unsigned char *report, int size, int timeout)
+{
+  return vfd_ir_read((vfd_t *)ctx, report, size, timeout);
+}
+
+
+int ir_transport_usb(ir_transport_t *t, vfd_t *vfd)
+{
+  if (vfd_ir_open(vfd, SHUTTLE_IR_INTERFACE_NUM) < 0)
+    return -1;
+
+  t->read = usb_read;
+  t->ctx = vfd;
+  return 0;
+}
+
+
+static int replay_read(void *ctx, unsigned char *report, int size, int timeout)
+{
+  struct ir_replay *r = (struct ir_replay *)ctx;
+  char line[256], *p, *endptr;
+  unsigned long b;
+
+  while (!r->loaded) {
+    if (fgets(line, sizeof(line), r->fp) == NULL)
+      return -1; // end of recording
+
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+
+    r->delay = strtol(line, &p, 10);
+    memset(r->report, 0, SHUTTLE_IR_REPORT_SIZE);
+    for (r->len = 0; r->len < SHUTTLE_IR_REPORT_SIZE; r->len++) {
+      b = strtoul(p, &endptr, 16);
+      if (endptr == p)
+        break;
+      r->report[r->len] = (unsigned char)b;
+      p = endptr;
+    }
+    r->loaded = (r->len > 0);
+  }
+
+  /* Honour the read timeout, like the interrupt endpoint would */
+  if (r->delay > timeout) {
+    usleep(timeout * 1000);
+    r->delay -= timeout;
+    return 0;
+  }
+
+  if (r->delay > 0)
+    usleep(r->delay * 1000);
+
+  r->loaded = 0;
+  if (size > r->len)
+    size = r->len;
+  memcpy(report, r->report, size);
+  return size;
+}
+
+
+int ir_transport_replay(ir_transport_t *t, const char *filename)
+{
+  memset(&ir_replay, 0, sizeof(ir_replay));
+
+  ir_replay.fp = fopen(filename, "r");
+  if (ir_replay.fp == NULL) {
+    fprintf(stderr, "err: can't open IR replay file %s\n", filename);
+    return -1;
+  }
+
+  t->read = replay_read;
+  t->ctx = &ir_replay;
+  return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int ir_register_callback(ir_callback cb, void *data)
+{
+  if (ir_callbacks_nb >= SHUTTLE_IR_MAX_CALLBACKS)
+    return -1;
+
+  ir_callbacks[ir_callbacks_nb].cb = cb;
+  ir_callbacks[ir_callbacks_nb].data = data;
+  ir_callbacks_nb++;
+  return 0;
+}
+
+
+/* Must be called before ir_uinput_open(), keys are declared at creation */
+int ir_set_key(unsigned long scancode, int keycode)
+{
+  int i;
+
+  for (i = 0; i < ir_keymap_nb; i++) {
+    if (ir_keymap[i].scancode == scancode) {
+      ir_keymap[i].keycode = keycode;
+      return 0;
+    }
+  }
+
+  if (ir_keymap_nb >= IR_KEYMAP_SIZE)
+    return -1;
+
+  ir_keymap[ir_keymap_nb].scancode = scancode;
+  ir_keymap[ir_keymap_nb].keycode = keycode;
+  ir_keymap_nb++;
+  return 0;
+}
+
+
+/* Must be called before ir_uinput_open(). Returns keys loaded, <0 on error */
+int ir_load_keymap(const char *filename)
+{
+  char line[256], name[64];
+  unsigned long scancode;
+  int i, keycode, n = 0, lineno = 0;
+  FILE *fp;
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "err: can't open IR keymap %s\n", filename);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+
+    if (sscanf(line, "%lx %63s", &scancode, name) != 2) {
+      fprintf(stderr, "wrn: %s:%d: malformed line, ignoring\n", filename, lineno);
+      continue;
+    }
+
+    keycode = KEY_UNKNOWN;
+    for (i = 0; i < sizeof(ir_key_names)/sizeof(ir_key_names[0]); i++) {
+      if (strcmp(name, ir_key_names[i].name) == 0) {
+        keycode = ir_key_names[i].keycode;
+        break;
+      }
+    }
+    if (keycode == KEY_UNKNOWN && sscanf(name, "%d", &keycode) != 1) {
+      fprintf(stderr, "wrn: %s:%d: unknown key %s, ignoring\n", filename,
+          lineno, name);
+      continue;
+    }
+
+    if (ir_set_key(scancode, keycode) < 0) {
+      fprintf(stderr, "wrn: %s: keymap full\n", filename);
+      break;
+    }
+    n++;
+  }
+
+  fclose(fp);
+  return n;
+}
+
+
+static int ir_lookup(unsigned long scancode)
+{
+  int i;
+
+  for (i = 0; i < ir_keymap_nb; i++) {
+    if (ir_keymap[i].scancode == scancode)
+      return ir_keymap[i].keycode;
+  }
+  return KEY_UNKNOWN;
+}
+
+
+int ir_uinput_open(const char *name)
+{
+  struct uinput_user_dev dev;
+  int i, fd;
+
+  fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+  if (fd < 0) {
+    fprintf(stderr, "err: can't open /dev/uinput\n");
+    return -1;
+  }
+
+  ioctl(fd, UI_SET_EVBIT, EV_KEY);
+  ioctl(fd, UI_SET_EVBIT, EV_SYN);
+  for (i = 0; i < ir_keymap_nb; i++)
+    ioctl(fd, UI_SET_KEYBIT, ir_keymap[i].keycode);
+
+  memset(&dev, 0, sizeof(dev));
+  strncpy(dev.name, name, UINPUT_MAX_NAME_SIZE - 1);
+  dev.id.bustype = BUS_USB;
+  dev.id.vendor  = SHUTTLE_VFD_VENDOR_ID;
+  dev.id.product = SHUTTLE_VFD_PRODUCT_ID;
+
+  if (write(fd, &dev, sizeof(dev)) != sizeof(dev) ||
+      ioctl(fd, UI_DEV_CREATE) < 0) {
+    fprintf(stderr, "err: can't create uinput device\n");
+    close(fd);
+    return -2;
+  }
+
+  ir_uinput_fd = fd;
+  return 0;
+}
+
+
+static void uinput_emit(int type, int code, int value)
+{
+  struct input_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.type = type;
+  ev.code = code;
+  ev.value = value;
+  if (write(ir_uinput_fd, &ev, sizeof(ev)) != sizeof(ev))
+    fprintf(stderr, "wrn: uinput write failed\n");
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Returns 1 for a key press, 0 for a release, -1 for a malformed report */
+int ir_decode(const unsigned char *report, int len, unsigned long *scancode)
+{
+  if (len < 4)
+    return -1;
+
+  *scancode = ((unsigned long)report[0] << 24) | (report[1] << 16) |
+    (report[2] << 8) | report[3];
+
+  return (*scancode != 0);
+}
+
+
+static void ir_dispatch(unsigned long scancode, int value)
+{
+  int i, keycode;
+
+  keycode = ir_lookup(scancode);
+  if (keycode == KEY_UNKNOWN && value == 1)
+    fprintf(stderr, "dbg: unknown IR scancode 0x%08lx\n", scancode);
+
+  if (ir_uinput_fd >= 0 && keycode != KEY_UNKNOWN) {
+    uinput_emit(EV_KEY, keycode, value);
+    uinput_emit(EV_SYN, SYN_REPORT, 0);
+  }
+
+  for (i = 0; i < ir_callbacks_nb; i++)
+    ir_callbacks[i].cb(scancode, keycode, value, ir_callbacks[i].data);
+}
+
+
+static void *ir_reader(void *arg)
+{
+  unsigned char report[SHUTTLE_IR_REPORT_SIZE];
+  unsigned long scancode, held = 0;
+  int len;
+
+  while (ir_running) {
+    len = ir_transport.read(ir_transport.ctx, report, SHUTTLE_IR_REPORT_SIZE,
+        SHUTTLE_IR_READ_TIMEOUT);
+    if (len == 0)
+      continue;
+    if (len < 0)
+      break;
+
+    switch (ir_decode(report, len, &scancode)) {
+      case 1:
+        // same key again while held: autorepeat
+        if (scancode == held) {
+          ir_dispatch(scancode, 2);
+          break;
+        }
+        if (held != 0)
+          ir_dispatch(held, 0);
+        held = scancode;
+        ir_dispatch(scancode, 1);
+        break;
+      case 0:
+        if (held != 0)
+          ir_dispatch(held, 0);
+        held = 0;
+        break;
+      default:
+        fprintf(stderr, "wrn: short IR report (%d)\n", len);
+    }
+  }
+
+  if (held != 0)
+    ir_dispatch(held, 0);
+
+  fprintf(stderr, "dbg: IR reader stopped\n");
+  ir_reading = 0;
+  return NULL;
+}
+
+
+int ir_start(ir_transport_t *t)
+{
+  if (ir_running)
+    return -1;
+
+  memcpy(&ir_transport, t, sizeof(ir_transport_t));
+  ir_running = 1;
+  ir_reading = 1;
+
+  if (pthread_create(&ir_thread, NULL, ir_reader, NULL) != 0) {
+    fprintf(stderr, "err: can't start IR reader\n");
+    ir_running = ir_reading = 0;
+    return -2;
+  }
+  return 0;
+}
+
+
+/* 0 once the transport is exhausted (end of recording, device gone) */
+int ir_active(void)
+{
+  return ir_reading;
+}
+
+
+int ir_stop(void)
+{
+  if (ir_running) {
+    ir_running = 0;
+    pthread_join(ir_thread, NULL);
+  }
+
+  if (ir_uinput_fd >= 0) {
+    ioctl(ir_uinput_fd, UI_DEV_DESTROY);
+    close(ir_uinput_fd);
+    ir_uinput_fd = -1;
+  }
+
+  if (ir_transport.read == usb_read)
+    vfd_ir_close((vfd_t *)ir_transport.ctx, SHUTTLE_IR_INTERFACE_NUM);
+  else if (ir_replay.fp != NULL) {
+    fclose(ir_replay.fp);
+    ir_replay.fp = NULL;
+  }
+
+  return 0;
+}
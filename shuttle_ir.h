@@ -0,0 +1,55 @@
+/*
+ * shuttle_ir.h - IR receiver (remote control) input path.
+ * Copyright (C) 2008 Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+ */
+
+#ifndef SHUTTLE_IR_H
+#define SHUTTLE_IR_H
+
+#include "shuttle_vfd.h"
+
+#define SHUTTLE_IR_REPORT_SIZE      6
+#define SHUTTLE_IR_READ_TIMEOUT     100 // ms, how fast ir_stop() is noticed
+#define SHUTTLE_IR_MAX_CALLBACKS    8
+
+/* Read one report: returns its length, 0 on timeout, <0 on error/end */
+typedef int (*ir_read_func)(void *ctx, unsigned char *report, int size,
+    int timeout);
+
+typedef struct {
+  ir_read_func read;
+  void *ctx;
+} ir_transport_t;
+
+/* Called from the reader thread, keep it short */
+typedef void (*ir_callback)(unsigned long scancode, int keycode, int pressed,
+    void *data);
+
+/* Prototypes */
+
+int ir_transport_usb(ir_transport_t *, vfd_t *);
+int ir_transport_replay(ir_transport_t *, const char *);
+int ir_register_callback(ir_callback, void *);
+int ir_set_key(unsigned long, int);
+int ir_load_keymap(const char *);
+int ir_uinput_open(const char *);
+int ir_decode(const unsigned char *, int, unsigned long *);
+int ir_start(ir_transport_t *);
+int ir_stop(void);
+int ir_active(void);
+
+#endif /* SHUTTLE_IR_H */
@@ -34,100 +34,287 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <usb.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "shuttle_vfd.h"
 
 #define DEC_AS_HEX(v)   (((v)/10 * 16) + ((v)%10))
 
-/* Global data */
-static usb_dev_handle *vfd_dev;
+/* Device handle. Everything lives here, so several handles (or threads
+ * sharing one handle) don't step on each other. */
+struct vfd_s {
+  usb_dev_handle *dev;
+  int interface;
 
+  /* Held for a whole frame (recursive: vfd_send_packet takes it too) */
+  pthread_mutex_t lock;
+  int depth;                  // frame writers nesting
+  struct timespec frame_end;  // budget of the outermost one
+  int cursor_dirty;           // text frame given up, cursor position unknown
 
-int vfd_init(int vendor_id, int product_id, int interface)
+  int breaker;
+  int failures;
+  struct timespec opened_at;
+
+  /* Icons don't wait for the end of a frame: they are queued here and
+   * sent by the lock owner right after its current packet */
+  pthread_mutex_t icons_lock;
+  unsigned long icons;  // last icons sent
+  unsigned long icons_queued;
+  int icons_pending;
+};
+
+/* libusb-0.1 bus enumeration is not thread-safe */
+static pthread_mutex_t vfd_usb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+int vfd_version(void)
 {
-  int ret = 0;
+  return SHUTTLE_VFD_VERSION;
+}
+
+
+vfd_t *vfd_open(int vendor_id, int product_id, int interface)
+{
+  vfd_t *vfd;
   struct usb_bus *bus;
   struct usb_device *dev;
+  pthread_mutexattr_t attr;
+
+  vfd = calloc(1, sizeof(vfd_t));
+  if (vfd == NULL)
+    return NULL;
 
+  pthread_mutex_lock(&vfd_usb_lock);
   usb_init();
   usb_find_busses();
   usb_find_devices();
 
-  for (bus = usb_get_busses(); bus != NULL; bus = bus->next) {
+  for (bus = usb_get_busses(); bus != NULL && vfd->dev == NULL; bus = bus->next) {
     for (dev = bus->devices; dev != NULL; dev = dev->next) {
       if (dev->descriptor.idVendor == vendor_id &&
           dev->descriptor.idProduct == product_id) {
-        vfd_dev = usb_open(dev);
+        vfd->dev = usb_open(dev);
+        break;
       }
     }
   }
+  pthread_mutex_unlock(&vfd_usb_lock);
 
-  if (vfd_dev == NULL) {
+  if (vfd->dev == NULL) {
     fprintf(stderr, "err: can't open Shuttle VFD\n");
-    ret = -1;
+    free(vfd);
+    return NULL;
   }
 
-  if (usb_claim_interface(vfd_dev, interface) < 0) {
-    usb_close(vfd_dev);
+  if (usb_claim_interface(vfd->dev, interface) < 0) {
+    usb_close(vfd->dev);
+    free(vfd);
 
     // TODO check for root user ?
     fprintf(stderr, "err: unable to claim interface. You may retry with root privileges.\n");
-    ret = -2;
+    return NULL;
   }
 
-  return ret;
+  vfd->interface = interface;
+  vfd->breaker = VFD_BREAKER_CLOSED;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&vfd->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  pthread_mutex_init(&vfd->icons_lock, NULL);
+
+  return vfd;
 }
 
 
-int vfd_close(int interface)
+int vfd_close(vfd_t *vfd)
 {
   int ret = 0;
 
-  if (usb_release_interface(vfd_dev, SHUTTLE_VFD_INTERFACE_NUM) < 0) {
+  if (vfd == NULL)
+    return -1;
+
+  if (usb_release_interface(vfd->dev, vfd->interface) < 0) {
     fprintf(stderr, "err: unable to release interface\n");
     ret = -1;
   }
 
-  if (usb_close(vfd_dev) < 0) {
+  if (usb_close(vfd->dev) < 0) {
     fprintf(stderr, "err: can't close Shuttle VFD\n");
     ret = -2;
   }
 
+  pthread_mutex_destroy(&vfd->lock);
+  pthread_mutex_destroy(&vfd->icons_lock);
+  free(vfd);
+
   return ret;
 }
 
 
-int vfd_send_packet(unsigned char packet[SHUTTLE_VFD_PACKET_SIZE])
+static int vfd_flush_icons(vfd_t *);
+
+
+/* Release the frame lock. Icons queued meanwhile (while we were sending a
+ * packet) are sent now, unless someone else got the lock: it will. Updates
+ * queued during that icon packet are sent too, one packet each (updates
+ * queued during the same packet are merged). */
+static void vfd_unlock(vfd_t *vfd)
+{
+  int pending;
+
+  for (;;) {
+    pthread_mutex_unlock(&vfd->lock);
+
+    pthread_mutex_lock(&vfd->icons_lock);
+    pending = vfd->icons_pending;
+    pthread_mutex_unlock(&vfd->icons_lock);
+
+    if (!pending || pthread_mutex_trylock(&vfd->lock) != 0)
+      break;
+    vfd_flush_icons(vfd);
+  }
+}
+
+
+/* Frame writers (nested calls included) share SHUTTLE_VFD_FRAME_MAX_USEC */
+static void vfd_frame_begin(vfd_t *vfd)
+{
+  long long nsec;
+
+  pthread_mutex_lock(&vfd->lock);
+  if (vfd->depth++ == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &vfd->frame_end);
+    nsec = vfd->frame_end.tv_nsec + SHUTTLE_VFD_FRAME_MAX_USEC * 1000LL;
+    vfd->frame_end.tv_sec += nsec / 1000000000;
+    vfd->frame_end.tv_nsec = nsec % 1000000000;
+  }
+}
+
+
+static void vfd_frame_end(vfd_t *vfd)
+{
+  vfd->depth--;
+  vfd_unlock(vfd);
+}
+
+
+/* Can an attempt of 'usec' start now without ending past frame budget? */
+static int vfd_frame_fits(vfd_t *vfd, long long usec)
 {
-  int i, ret = -1;
+  struct timespec now;
 
-  for (i = 0; i < SHUTTLE_VFD_WRITE_ATTEMPTS; i++) {
-    if (usb_control_msg(vfd_dev,
+  if (vfd->depth == 0)
+    return 1;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (vfd->frame_end.tv_sec - now.tv_sec) * 1000000LL +
+    (vfd->frame_end.tv_nsec - now.tv_nsec) / 1000 >= usec;
+}
+
+
+/* Returns 0 on success, -1 on write failure, -2 if the breaker is open
+ * (nothing sent). With 'budget', attempts that could end past the frame
+ * budget are not made (-1). */
+static int vfd_send(vfd_t *vfd, unsigned char packet[SHUTTLE_VFD_PACKET_SIZE],
+    int budget)
+{
+  const long long attempt = SHUTTLE_VFD_WRITE_TIMEOUT_MSEC * 1000LL +
+    SHUTTLE_VFD_SUCCESS_SLEEP_USEC;
+  int i, attempts, ret = -1;
+  struct timespec now;
+
+  pthread_mutex_lock(&vfd->lock);
+
+  if (vfd->breaker == VFD_BREAKER_OPEN) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - vfd->opened_at.tv_sec) * 1000000LL +
+        (now.tv_nsec - vfd->opened_at.tv_nsec) / 1000 <
+        SHUTTLE_VFD_BREAKER_COOLDOWN_USEC) {
+      vfd_unlock(vfd);
+      return -2;
+    }
+
+    vfd->breaker = VFD_BREAKER_HALF_OPEN;
+  }
+
+  // a probe gets a single attempt
+  attempts = (vfd->breaker == VFD_BREAKER_HALF_OPEN) ? 1 :
+    SHUTTLE_VFD_WRITE_ATTEMPTS;
+
+  for (i = 0; i < attempts; i++) {
+    if (budget && !vfd_frame_fits(vfd, attempt)) {
+      fprintf(stderr, "wrn: frame time budget exceeded, giving up frame\n");
+      break;
+    }
+
+    if (usb_control_msg(vfd->dev,
           0x21,      // requesttype
           0x09,      // request
           0x0200,    // value
           0x0001,    // index
           (char *)packet,
-          SHUTTLE_VFD_PACKET_SIZE, 100) == SHUTTLE_VFD_PACKET_SIZE) {
+          SHUTTLE_VFD_PACKET_SIZE,
+          SHUTTLE_VFD_WRITE_TIMEOUT_MSEC) == SHUTTLE_VFD_PACKET_SIZE) {
 
       usleep(SHUTTLE_VFD_SUCCESS_SLEEP_USEC);
       ret = 0;
       break;
     }
 
-    fprintf(stderr, "wrn: write failed retrying...\n");
-    usleep(SHUTTLE_VFD_RETRY_SLEEP_USEC);
+    if (i + 1 < attempts) {
+      if (budget && !vfd_frame_fits(vfd, SHUTTLE_VFD_RETRY_SLEEP_USEC + attempt)) {
+        fprintf(stderr, "wrn: frame time budget exceeded, giving up frame\n");
+        break;
+      }
+      fprintf(stderr, "wrn: write failed retrying...\n");
+      usleep(SHUTTLE_VFD_RETRY_SLEEP_USEC);
+    }
+  }
+
+  if (ret == 0 && i == 0) {
+    if (vfd->breaker != VFD_BREAKER_CLOSED)
+      fprintf(stderr, "dbg: Shuttle VFD is back\n");
+    vfd->breaker = VFD_BREAKER_CLOSED;
+    vfd->failures = 0;
+  } else if (vfd->breaker == VFD_BREAKER_HALF_OPEN ||
+      ++vfd->failures >= SHUTTLE_VFD_BREAKER_THRESHOLD) {
+    // a flaky device (packets only going through on retry) opens it too
+    if (vfd->breaker == VFD_BREAKER_CLOSED)
+      fprintf(stderr, "err: Shuttle VFD not responding, suspending writes\n");
+    vfd->breaker = VFD_BREAKER_OPEN;
+    clock_gettime(CLOCK_MONOTONIC, &vfd->opened_at);
   }
 
+  vfd_unlock(vfd);
   return ret;
 }
 
 
-int vfd_clear(int b)
+/* Spends up to SHUTTLE_VFD_PACKET_MAX_USEC for this packet, plus as much
+ * for each icons update queued by another thread meanwhile (sent right
+ * after it, see vfd_unlock). */
+int vfd_send_packet(vfd_t *vfd, unsigned char packet[SHUTTLE_VFD_PACKET_SIZE])
+{
+  return vfd_send(vfd, packet, 0);
+}
+
+
+int vfd_breaker_state(vfd_t *vfd)
+{
+  return vfd->breaker;
+}
+
+
+int vfd_clear(vfd_t *vfd, int b)
 {
   unsigned char packet[SHUTTLE_VFD_PACKET_SIZE];
+  unsigned long icons = 0;
   memset(packet, 0, SHUTTLE_VFD_PACKET_SIZE);
   packet[0] = (1 << 4) + 1;
 
@@ -136,19 +323,46 @@ int vfd_clear(int b)
   else
     packet[1] = 2; // just reset the text cursor (keep text)
 
-  return vfd_send_packet(packet);
+  // icons queued before a full clear must not show up after it. Icons
+  // state is reset before sending: icons queued meanwhile are sent right
+  // after the clear packet, and update it.
+  vfd_frame_begin(vfd);
+  if (b == 0) {
+    pthread_mutex_lock(&vfd->icons_lock);
+    vfd->icons_pending = 0;
+    icons = vfd->icons;
+    vfd->icons = 0;
+    pthread_mutex_unlock(&vfd->icons_lock);
+  }
+
+  if (vfd_send(vfd, packet, 1) < 0) {
+    if (b == 0) {
+      // nothing changed, unless icons were sent meanwhile
+      pthread_mutex_lock(&vfd->icons_lock);
+      if (vfd->icons == 0)
+        vfd->icons = icons;
+      pthread_mutex_unlock(&vfd->icons_lock);
+    }
+    vfd_frame_end(vfd);
+    return -1;
+  }
+  vfd->cursor_dirty = 0;
+
+  vfd_frame_end(vfd);
+  return 0;
 }
 
 
 /* Built-in feature (of Cypress controller), will display SHUTTLE_VFD_ICON_CLOCK */
-int vfd_display_clock(void)
+int vfd_display_clock(vfd_t *vfd)
 {
   unsigned char packet[SHUTTLE_VFD_PACKET_SIZE];
-  struct tm *now;
+  struct tm tm, *now = &tm;
   time_t t;
+  int ret;
 
   time(&t);
-  now = localtime(&t);
+  localtime_r(&t, now);
 
   /* Warning: Hexa values are decimal values !
    * 30 16 14 07 14 09 08 : "Sep 14 Sun 02:16 PM"
@@ -162,58 +376,184 @@ int vfd_display_clock(void)
   packet[5] = DEC_AS_HEX(now->tm_mday);     // day
   packet[6] = DEC_AS_HEX(now->tm_mon+1);    // month
   packet[7] = DEC_AS_HEX(now->tm_year-100); // year
-  vfd_send_packet(packet);
 
-  memset(packet, 0, SHUTTLE_VFD_PACKET_SIZE);
-  packet[0] = (3 << 4) + 1;
-  packet[1] = 3;
-  return vfd_send_packet(packet);
+  vfd_frame_begin(vfd);
+  ret = vfd_send(vfd, packet, 1);
+  if (ret == 0) {
+    memset(packet, 0, SHUTTLE_VFD_PACKET_SIZE);
+    packet[0] = (3 << 4) + 1;
+    packet[1] = 3;
+    ret = vfd_send(vfd, packet, 1);
+  }
+  vfd_frame_end(vfd);
+
+  return ret;
 }
 
 
-/* Simple text display (full screen write, no cursor management) */
-int vfd_display_text(const char *text, unsigned int len, const useconds_t delai)
+/* Simple text display (full screen write, no cursor management).
+ * Gives up at the first failed packet, the frame is lost anyway; the
+ * cursor is then somewhere in the line, so next text resets it first. */
+int vfd_display_text(vfd_t *vfd, const char *text, unsigned int len,
+    unsigned int delai)
 {
   unsigned char packet[SHUTTLE_VFD_PACKET_SIZE];
   int i;
   char *p = (char *)text;
+  int ret = 0;
 
   if (len > SHUTTLE_VFD_WIDTH) {
     len = SHUTTLE_VFD_WIDTH;
   }
 
-  for (i = 0; i < (len/SHUTTLE_VFD_DATA_SIZE); i++) {
+  vfd_frame_begin(vfd);
+
+  if (vfd->cursor_dirty)
+    ret = vfd_clear(vfd, 1);
+
+  for (i = 0; ret == 0 && i < (len/SHUTTLE_VFD_DATA_SIZE); i++) {
     packet[0] = (9 << 4) + SHUTTLE_VFD_DATA_SIZE;
     memcpy(packet + 1, p, SHUTTLE_VFD_DATA_SIZE);
     p += SHUTTLE_VFD_DATA_SIZE;
-    vfd_send_packet(packet);
+    if ((ret = vfd_send(vfd, packet, 1)) < 0)
+      break;
   }
 
   len = len % SHUTTLE_VFD_DATA_SIZE;
-  if (len != 0) {
+  if (len != 0 && ret == 0) {
     memset(packet, 0, SHUTTLE_VFD_PACKET_SIZE);
     packet[0] = (9 << 4) + len;
     memcpy(packet + 1, p, len);
-    vfd_send_packet(packet);
+    ret = vfd_send(vfd, packet, 1);
   }
 
+  if (ret < 0)
+    vfd->cursor_dirty = 1;
+  vfd_frame_end(vfd);
+
   if (delai)
     usleep(delai);
 
-  return 0;
+  return ret;
 }
 
 
-int vfd_display_icons(unsigned long value)
+/* Cursor reset then text: one frame, one SHUTTLE_VFD_FRAME_MAX_USEC budget */
+int vfd_display_frame(vfd_t *vfd, const char *text, unsigned int len)
+{
+  int ret;
+
+  vfd_frame_begin(vfd);
+  ret = vfd_clear(vfd, 1);
+  if (ret == 0)
+    ret = vfd_display_text(vfd, text, len, 0);
+  vfd_frame_end(vfd);
+
+  return ret;
+}
+
+
+/* Send queued icons, if any. Caller holds the frame lock, between two
+ * packets (the icon packet doesn't move the text cursor). */
+static int vfd_flush_icons(vfd_t *vfd)
 {
   unsigned char packet[SHUTTLE_VFD_PACKET_SIZE];
+  unsigned long value;
+  int ret;
+
+  pthread_mutex_lock(&vfd->icons_lock);
+  if (!vfd->icons_pending) {
+    pthread_mutex_unlock(&vfd->icons_lock);
+    return 0;
+  }
+  value = vfd->icons_queued;
+  vfd->icons_pending = 0;
+  pthread_mutex_unlock(&vfd->icons_lock);
+
   memset(packet, 0, SHUTTLE_VFD_PACKET_SIZE);
   packet[0] = (7 << 4) + 4;
   packet[1] = (value >> 15) & 0x1F;
   packet[2] = (value >> 10) & 0x1F;
   packet[3] = (value >>  5) & 0x1F;
   packet[4] = value & 0x1F; // each data byte is stored on 5 bits
-  return vfd_send_packet(packet);
+
+  ret = vfd_send_packet(vfd, packet);
+  if (ret == 0) {
+    pthread_mutex_lock(&vfd->icons_lock);
+    vfd->icons = value;
+    pthread_mutex_unlock(&vfd->icons_lock);
+  }
+
+  return ret;
+}
+
+
+/* Queued icons are sent now, or right after the current packet when
+ * another thread is sending a frame (returns 0 then). */
+static int vfd_send_icons(vfd_t *vfd)
+{
+  int ret;
+
+  if (pthread_mutex_trylock(&vfd->lock) != 0)
+    return 0;
+
+  ret = vfd_flush_icons(vfd);
+  vfd_unlock(vfd);
+
+  return ret;
+}
+
+
+int vfd_display_icons(vfd_t *vfd, unsigned long value)
+{
+  pthread_mutex_lock(&vfd->icons_lock);
+  vfd->icons_queued = value;
+  vfd->icons_pending = 1;
+  pthread_mutex_unlock(&vfd->icons_lock);
+
+  return vfd_send_icons(vfd);
+}
+
+
+/* Change only the icons in 'mask', others are kept. Nothing is sent when
+ * the result is already displayed (or queued). */
+int vfd_update_icons(vfd_t *vfd, unsigned long mask, unsigned long value)
+{
+  unsigned long icons, cur;
+
+  pthread_mutex_lock(&vfd->icons_lock);
+  cur = vfd->icons_pending ? vfd->icons_queued : vfd->icons;
+  icons = (cur & ~mask) | (value & mask);
+  if (icons == cur) {
+    pthread_mutex_unlock(&vfd->icons_lock);
+    return 0;
+  }
+  vfd->icons_queued = icons;
+  vfd->icons_pending = 1;
+  pthread_mutex_unlock(&vfd->icons_lock);
+
+  return vfd_send_icons(vfd);
+}
+
+
+/* Quantize a level (0-100) on the 12 volume bars, 0 lights no bar */
+unsigned long vfd_level_icons(int percent)
+{
+  if (percent <= 0)
+    return 0;
+  if (percent > 100)
+    percent = 100;
+
+  return ((12 * percent + 99) / 100) << 15;
+}
+
+
+/* Same for a volume, 0 lights mute icon */
+unsigned long vfd_volume_icons(int percent)
+{
+  if (percent <= 0)
+    return SHUTTLE_VFD_ICON_MUTE;
+  return vfd_level_icons(percent);
 }
 
 
@@ -226,7 +566,7 @@ int vfd_parse_icons(const char *name, unsigned long *val)
 
   int i;
 
-  static struct vfd_icons icons[] = {
+  static const struct vfd_icons icons[] = {
     { "clk", "clock",   SHUTTLE_VFD_ICON_CLOCK},
     { "rad", "radio",   SHUTTLE_VFD_ICON_RADIO},
     { "mus", "music",   SHUTTLE_VFD_ICON_MUSIC},
@@ -267,3 +607,47 @@ int vfd_parse_icons(const char *name, unsigned long *val)
 
   return ((*val == 0) ? -1 : 0);
 }
+
+
+/* IR receiver is a HID interface, usbhid may have grabbed it first */
+int vfd_ir_open(vfd_t *vfd, int interface)
+{
+  if (vfd == NULL)
+    return -1;
+
+  usb_detach_kernel_driver_np(vfd->dev, interface);
+
+  if (usb_claim_interface(vfd->dev, interface) < 0) {
+    fprintf(stderr, "err: unable to claim IR interface\n");
+    return -2;
+  }
+
+  return 0;
+}
+
+
+/* Read one input report. Returns its length, 0 on timeout or <0 on error.
+ * Uses the interrupt endpoint, so it can run alongside vfd_send_packet(). */
+int vfd_ir_read(vfd_t *vfd, unsigned char *report, int size, int timeout)
+{
+  int ret;
+
+  ret = usb_interrupt_read(vfd->dev, SHUTTLE_IR_ENDPOINT, (char *)report,
+      size, timeout);
+
+  if (ret == -ETIMEDOUT || ret == -EAGAIN)
+    ret = 0;
+
+  return ret;
+}
+
+
+int vfd_ir_close(vfd_t *vfd, int interface)
+{
+  if (usb_release_interface(vfd->dev, interface) < 0) {
+    fprintf(stderr, "err: unable to release IR interface\n");
+    return -1;
+  }
+
+  return 0;
+}
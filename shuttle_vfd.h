@@ -20,12 +20,25 @@
 #ifndef SHUTTLE_VFD_H
 #define SHUTTLE_VFD_H
 
+#include <sys/types.h>
 #include <time.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Library version (runtime value: vfd_version())
+#define SHUTTLE_VFD_VERSION_MAJOR   1
+#define SHUTTLE_VFD_VERSION_MINOR   2
+#define SHUTTLE_VFD_VERSION \
+  ((SHUTTLE_VFD_VERSION_MAJOR << 16) | SHUTTLE_VFD_VERSION_MINOR)
+
 // VFD USB properties
 #define SHUTTLE_VFD_VENDOR_ID  0x051C
 #define SHUTTLE_VFD_PRODUCT_ID 0x0005 // IR-receiver included
 #define SHUTTLE_VFD_INTERFACE_NUM   1
+#define SHUTTLE_IR_INTERFACE_NUM    0
+#define SHUTTLE_IR_ENDPOINT         0x81 // interrupt IN
 
 // VFD physical dimensions
 #define SHUTTLE_VFD_WIDTH          20
@@ -37,6 +50,34 @@
 #define SHUTTLE_VFD_WRITE_ATTEMPTS      2
 #define SHUTTLE_VFD_SUCCESS_SLEEP_USEC  25600
 #define SHUTTLE_VFD_RETRY_SLEEP_USEC    25600
+#define SHUTTLE_VFD_WRITE_TIMEOUT_MSEC  100
+
+// Circuit breaker: after THRESHOLD consecutive failed packets, sends fail
+// immediately. One probe packet is allowed after COOLDOWN. A packet that
+// only went through on retry counts as a failed one.
+#define SHUTTLE_VFD_BREAKER_THRESHOLD   3
+#define SHUTTLE_VFD_BREAKER_COOLDOWN_USEC 2000000
+
+// Worst case spent in one packet (icon packets queued meanwhile by other
+// threads are sent right after it, each one up to this too)
+#define SHUTTLE_VFD_PACKET_MAX_USEC \
+  (SHUTTLE_VFD_WRITE_ATTEMPTS * SHUTTLE_VFD_WRITE_TIMEOUT_MSEC * 1000 + \
+   (SHUTTLE_VFD_WRITE_ATTEMPTS - 1) * SHUTTLE_VFD_RETRY_SLEEP_USEC + \
+   SHUTTLE_VFD_SUCCESS_SLEEP_USEC)
+
+// Worst case spent in one frame writer call (vfd_display_frame: cursor
+// reset + 3 text packets, vfd_display_text, vfd_display_clock, vfd_clear).
+// No attempt is started, nor retried, if it could end past this budget:
+// the rest of the frame is given up and counted as a failed packet.
+// Leaves room for 4 packets and one retry. Icon packets sent between frame
+// packets take from it but aren't bounded by it.
+#define SHUTTLE_VFD_FRAME_MAX_USEC      350000
+
+enum vfd_breaker_states {
+  VFD_BREAKER_CLOSED,    // normal operation
+  VFD_BREAKER_OPEN,      // device considered gone, fail fast
+  VFD_BREAKER_HALF_OPEN  // probing
+};
 
 // VFD Icons
 #define SHUTTLE_VFD_ICON_CLOCK          (1 << 4)
@@ -68,16 +109,33 @@
 #define SHUTTLE_VFD_ICON_VOL_12         (12 << 15)
 
 #define SHUTTLE_VFD_ALL_ICONS           (0x7FFF|SHUTTLE_VFD_ICON_VOL_12)
+#define SHUTTLE_VFD_ICON_VOL_MASK       (0x1F << 15)
+
+/* Opaque device handle */
+typedef struct vfd_s vfd_t;
 
 /* Prototypes */
 
-int vfd_init(int, int, int);
-int vfd_close(int);
-int vfd_send_packet(unsigned char packet[SHUTTLE_VFD_PACKET_SIZE]);
-int vfd_clear(int);
-int vfd_display_clock(void);
-int vfd_display_text(const char *, unsigned int, const useconds_t);
-int vfd_display_icons(unsigned long);
+int vfd_version(void);
+vfd_t *vfd_open(int, int, int);
+int vfd_close(vfd_t *);
+int vfd_send_packet(vfd_t *, unsigned char packet[SHUTTLE_VFD_PACKET_SIZE]);
+int vfd_breaker_state(vfd_t *);
+int vfd_clear(vfd_t *, int);
+int vfd_display_clock(vfd_t *);
+int vfd_display_text(vfd_t *, const char *, unsigned int, unsigned int);
+int vfd_display_frame(vfd_t *, const char *, unsigned int);
+int vfd_display_icons(vfd_t *, unsigned long);
+int vfd_update_icons(vfd_t *, unsigned long, unsigned long);
+unsigned long vfd_level_icons(int);
+unsigned long vfd_volume_icons(int);
 int vfd_parse_icons(const char *, unsigned long *);
+int vfd_ir_open(vfd_t *, int);
+int vfd_ir_read(vfd_t *, unsigned char *, int, int);
+int vfd_ir_close(vfd_t *, int);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* SHUTTLE_VFD_H */
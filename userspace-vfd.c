@@ -12,11 +12,8 @@
 TODO:
 - vfd_init should not be called when user request --help or --version.
 - blocking orders:
-  - cpu load (1 or 2 cpus)
   - cpu temp / fans / sensors
   - mplayer (via lirc interface?)
-- system monitoring non blocking orders:
-  - icons: auto from snd card master channel
 
 */
 
@@ -28,10 +25,20 @@ TODO:
 #include <locale.h>
 #include <time.h>
 #include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
 #include <sys/sysinfo.h>
+#include <linux/input.h>
 
 #include "shuttle_vfd.h"
+#include "shuttle_ir.h"
 #include "handler_list.h"
+#include "frame_buffer.h"
+#include "alsa_volume.h" // no ALSA header in it, just the API
+#ifdef HAVE_DBUS
+#include "mpris.h"
+#endif
 
 
 /* some defines */
@@ -40,99 +47,212 @@ TODO:
 
 #define TEST_STRING     "### Hello  World ###"
 #define BUFFER_SZ       252
+#define STDIN_BUFFER_SZ 4096
+#define STDIN_BATCH     64
+#define GRAPH_PASS      5     // samples shown per pass
 
 const char *spaces = "                    ";
-const useconds_t attente = 400000; // 0.5s
+const useconds_t attente = 400000; // 0.4s, one scroll step (2.5 chars/s)
 
 /* global variables */
-static char vfd_buf[SHUTTLE_VFD_WIDTH];
+static vfd_t *vfd;
+static unsigned long vfd_frame = 0; // text frames drawn so far
+static struct timespec vfd_due;     // when the frame being rendered is shown
 static handler_list_t vfd_orders;
 static volatile int quit = 0;
+static volatile int next_order = 0;
+
+/* One-shot orders posted at runtime (from other threads) */
+static handler_list_t vfd_alerts;
+static long vfd_wakeups = 0;  // bumped to end current frame wait early
+static pthread_mutex_t vfd_alerts_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vfd_alerts_cond;
+
+/* External alerts: new lines of a file (--alerts) */
+static tail_t vfd_alert_file;
+static int vfd_alert_watch = 0;
+static char vfd_alert_text[TAIL_LINE_SZ];
 
 static char buffer[BUFFER_SZ+4];
 
 /* local prototypes */
 static int app_display_text(const char *);
 static int app_display_centered_text(const char *);
+static int app_scroll(handler_t *, handler_scroll_t *, const char *,
+    int, int, int, useconds_t);
 
 
 /* Functions definition */
 
 /* ------------------------------------------------------------------------- */
 
-/* Left aligned text. If text is too large, it's truncated */
+/* Left aligned text. If text is too large, it's truncated.
+ * Rendered in the back frame, shown at vfd_due. */
 static int app_display_text(const char *text)
 {
+  char *buf = fb_back();
   int len, i = 0;
 
   len = strlen(text);
-  if (len > SHUTTLE_VFD_WIDTH) {
+  if (len > SHUTTLE_VFD_WIDTH)
     fprintf(stderr, "wrn: truncating text\n");
-  } else {
-    memset(vfd_buf, (int)' ', SHUTTLE_VFD_WIDTH);
-  }
-
-  vfd_clear(1);
+  memset(buf, (int)' ', SHUTTLE_VFD_WIDTH);
 
   while ((i<SHUTTLE_VFD_WIDTH) && (text[i] != 0)) {
-    vfd_buf[i] = text[i];
+    buf[i] = text[i];
     i++;
   }
 
-  return vfd_display_text(vfd_buf, SHUTTLE_VFD_WIDTH, 0);
+  vfd_frame++;
+  return fb_swap(1, &vfd_due);
 }
 
 
 /* If text is too large, it's truncated */
 static int app_display_centered_text(const char *text)
 {
+  char *buf = fb_back();
   int len = strlen(text);
+
   if (len > SHUTTLE_VFD_WIDTH) {
     fprintf(stderr, "wrn: truncating text\n");
-  } else {
-    memset(vfd_buf, (int)' ', SHUTTLE_VFD_WIDTH);
+    len = SHUTTLE_VFD_WIDTH;
   }
+  memset(buf, (int)' ', SHUTTLE_VFD_WIDTH);
+  memcpy(buf + (SHUTTLE_VFD_WIDTH - len)/2, text, len);
+
+  vfd_frame++;
+  return fb_swap(1, &vfd_due);
+}
+
+
+static long long usec_diff(const struct timespec *a, const struct timespec *b)
+{
+  return (a->tv_sec - b->tv_sec) * 1000000LL + (a->tv_nsec - b->tv_nsec) / 1000;
+}
 
-  vfd_clear(1);
-  memcpy(vfd_buf + (SHUTTLE_VFD_WIDTH - len)/2, text, len);
 
-  return vfd_display_text(vfd_buf, SHUTTLE_VFD_WIDTH, 0);
+static void usec_add(struct timespec *t, long long usec)
+{
+  usec += t->tv_nsec / 1000;
+  t->tv_sec += usec / 1000000;
+  t->tv_nsec = (usec % 1000000) * 1000;
+  if (t->tv_nsec < 0) {
+    t->tv_sec--;
+    t->tv_nsec += 1000000000;
+  }
+}
+
+
+/* Display buf + i*stride for i in [first, last], one position per step.
+ * Called once per frame. Position is computed from monotonic time at
+ * vfd_due: when USB is late, intermediate positions are skipped so the
+ * speed stays constant. Position is kept in 's', a preempted pass resumes where it
+ * stopped. Returns usec until next position, 0 at end of pass. */
+static int app_scroll(handler_t *h, handler_scroll_t *s, const char *buf,
+    int first, int last, int stride, useconds_t step)
+{
+  struct timespec now = vfd_due;
+  long long elapsed;
+  long pos;
+
+  if (h->state == ORDER_IDLE) {
+    s->start = now;
+    s->shown = first - 1;
+    s->dropped = 0;
+  } else if (h->state == ORDER_PREEMPTED) {
+    // shift time base: next position is due now
+    s->start = now;
+    usec_add(&s->start, -(s->shown + 1 - first) * (long long)step);
+  }
+  h->state = ORDER_RUNNING;
+
+  elapsed = usec_diff(&now, &s->start);
+  pos = first + elapsed / step;
+
+  if (pos > last) {
+    s->dropped += last - s->shown;
+    if (s->dropped > 0)
+      fprintf(stderr, "dbg: scrolling late, dropped %ld frame(s)\n", s->dropped);
+    h->state = ORDER_IDLE;
+    return 0;
+  }
+
+  if (pos > s->shown) {
+    if (pos > s->shown + 1)
+      s->dropped += pos - s->shown - 1;
+    s->shown = pos;
+
+    memcpy(fb_back(), buf + pos*stride, SHUTTLE_VFD_WIDTH);
+    vfd_frame++;
+    fb_swap(0, &vfd_due);
+  }
+
+  /* Time left until next position (absolute schedule, no drift) */
+  elapsed = (pos - first + 1) * (long long)step - elapsed;
+  return (elapsed > 0) ? elapsed : 1;
 }
 
 /* ------------------------------------------------------------------------- */
 
-static int cb_date_and_time(void *param)
+/* One frame per second. Next second is formatted ahead and its frame is
+ * due exactly on the second boundary. */
+static int cb_date_and_time(handler_t *req)
 {
-  handler_clock_t *h = (handler_clock_t *)param;
+  handler_clock_t *h = &req->data.clock;
 
-  struct tm *now;
+  struct timespec mono, wall;
+  struct tm now;
+  long long usec;
   time_t t;
 
-  if (h->format == NULL)
-    h->format = "%X (%a %d)"; // "%H:%M:%S";
+  if (req->state == ORDER_IDLE) {
+    h->shown = 0;
+    h->last = 0;
+  }
+  req->state = ORDER_RUNNING;
+
+  /* Wall clock time at vfd_due (half a millisecond of slack for rounding) */
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  clock_gettime(CLOCK_REALTIME, &wall);
+  usec_add(&wall, usec_diff(&vfd_due, &mono) + 500);
+  t = wall.tv_sec;
+  usec = 1000000 - wall.tv_nsec / 1000 + 500;
+
+  if (t != h->last) {
+    if (h->shown >= ((h->frames > 0) ? h->frames : 1)) {
+      req->state = ORDER_IDLE;
+      return 0;
+    }
+    h->shown++;
+    h->last = t;
 
-  time(&t);
-  now = localtime(&t);
-  strftime (buffer, BUFFER_SZ, h->format, now);
+    if (h->format == NULL)
+      h->format = "%X (%a %d)"; // "%H:%M:%S";
 
-  // display text without scrolling
-  app_display_centered_text(buffer);
+    localtime_r(&t, &now);
+    strftime (buffer, BUFFER_SZ, h->format, &now);
 
-  return 0;
+    // display text without scrolling
+    app_display_centered_text(buffer);
+  }
+
+  return usec;
 }
 
 /* ------------------------------------------------------------------------- */
 
-static int cb_text(void *param)
+static int cb_text(handler_t *req)
 {
-  handler_text_t *h = (handler_text_t *)param;
+  handler_text_t *h = &req->data.text;
 
-  int i, len;
+  int len;
 
   len = strlen(h->message);
   if ((len + 2*SHUTTLE_VFD_WIDTH) > 100) {
     len = 100 - 2*SHUTTLE_VFD_WIDTH;
-    fprintf(stderr, "wrn: truncating text (%d)\n", len);
+    if (req->state == ORDER_IDLE)
+      fprintf(stderr, "wrn: truncating text (%d)\n", len);
   }
 
   /* Build the big one-line message */
@@ -142,29 +262,20 @@ static int cb_text(void *param)
 
   // Display per page
   if (h->style & 0x1)
-  {
-    for (i = 1; i <= ((len/SHUTTLE_VFD_WIDTH)+1) && !quit; i++) {
-      vfd_display_text(buffer + i*SHUTTLE_VFD_WIDTH, SHUTTLE_VFD_WIDTH,
-          5*attente);
-    }
-  }
-  // Scrolling display
-  else
-  {
-    for (i = 0; i <= (len + SHUTTLE_VFD_WIDTH) && !quit; i++) {
-      vfd_display_text(buffer + i, SHUTTLE_VFD_WIDTH, attente);
-    }
-  }
+    return app_scroll(req, &h->scroll, buffer, 1, (len/SHUTTLE_VFD_WIDTH)+1,
+        SHUTTLE_VFD_WIDTH, 5*attente);
 
-  return 0;
+  // Scrolling display
+  return app_scroll(req, &h->scroll, buffer, 0, len + SHUTTLE_VFD_WIDTH, 1,
+      attente);
 }
 
 
-static int cb_text_uptime(void *param)
+static int cb_text_uptime(handler_t *req)
 {
-  //handler_text_t *h = (handler_text_t *)param;
+  handler_text_t *h = &req->data.text;
   struct sysinfo info;
-  int len, i;
+  int len;
 
   sysinfo(&info);
 
@@ -173,14 +284,264 @@ static int cb_text_uptime(void *param)
       spaces, info.uptime/3600, (info.uptime%3600)/60, spaces);
 
   /* The big one-line message is ready, let's display it */
-  for (i = 0; i <= (len - SHUTTLE_VFD_WIDTH)  && !quit; i++) {
-    vfd_display_text(buffer + i, SHUTTLE_VFD_WIDTH, attente);
+  return app_scroll(req, &h->scroll, buffer, 0, len - SHUTTLE_VFD_WIDTH, 1,
+      attente);
+}
+
+/* Line that may change at any time (when it does, caller resets req state
+ * and invalidates *frame). If it fits, it is drawn once and redrawn only
+ * when another order used the panel meanwhile (no USB traffic while nothing
+ * changes). Otherwise it scrolls. */
+static int app_marquee(handler_t *req, handler_scroll_t *s,
+    unsigned long *frame, const char *text, int centered)
+{
+  int len = strlen(text);
+
+  if (len <= SHUTTLE_VFD_WIDTH) {
+    if (req->state == ORDER_RUNNING) {
+      req->state = ORDER_IDLE;
+      return 0;
+    }
+    req->state = ORDER_RUNNING;
+
+    if (*frame != vfd_frame) {
+      if (centered)
+        app_display_centered_text(text);
+      else
+        app_display_text(text);
+      *frame = vfd_frame;
+    }
+    return attente;
   }
 
+  if (len > 100 - 2*SHUTTLE_VFD_WIDTH)
+    len = 100 - 2*SHUTTLE_VFD_WIDTH;
+
+  memcpy(buffer, spaces, SHUTTLE_VFD_WIDTH);
+  memcpy(buffer + SHUTTLE_VFD_WIDTH, text, len);
+  memcpy(buffer + SHUTTLE_VFD_WIDTH + len, spaces, SHUTTLE_VFD_WIDTH);
+
+  return app_scroll(req, s, buffer, 0, len + SHUTTLE_VFD_WIDTH, 1, attente);
+}
+
+
+#ifdef HAVE_DBUS
+/* Media player title */
+static int cb_now_playing(handler_t *req)
+{
+  handler_player_t *h = &req->data.player;
+  char title[MPRIS_TITLE_SZ];
+  long gen;
+
+  gen = mpris_get_title(title, MPRIS_TITLE_SZ);
+  if (gen != h->gen) {
+    // new title: restart from the beginning
+    h->gen = gen;
+    h->frame = vfd_frame - 1;
+    req->state = ORDER_IDLE;
+  }
+
+  return app_marquee(req, &h->scroll, &h->frame, title, 1);
+}
+#endif
+
+
+/* Newest line of a file */
+static int cb_tail(handler_t *req)
+{
+  handler_tail_t *h = &req->data.tail;
+
+  if (tail_update(&h->tail)) {
+    h->frame = vfd_frame - 1;
+    req->state = ORDER_IDLE;
+  }
+
+  return app_marquee(req, &h->scroll, &h->frame, h->tail.line, 0);
+}
+
+
+/* Activity history (sampled by app_sample), redrawn on each new sample */
+static int cb_graph(handler_t *req)
+{
+  handler_graph_t *h = &req->data.graph;
+  char line[GRAPH_WIDTH + 1];
+  long long usec;
+
+  if (req->state == ORDER_IDLE)
+    h->start = h->graph.samples;
+  req->state = ORDER_RUNNING;
+
+  if (h->graph.samples - h->start >= GRAPH_PASS) {
+    req->state = ORDER_IDLE;
+    return 0;
+  }
+
+  if (h->drawn != h->graph.samples || h->frame != vfd_frame) {
+    graph_render(&h->graph, line);
+    line[GRAPH_WIDTH] = 0;
+    app_display_text(line);
+
+    if (h->graph.bar)
+      vfd_update_icons(vfd, SHUTTLE_VFD_ICON_VOL_MASK | SHUTTLE_VFD_ICON_MUTE,
+          vfd_level_icons(graph_level(&h->graph)));
+
+    h->drawn = h->graph.samples;
+    h->frame = vfd_frame;
+  }
+
+  usec = graph_next(&h->graph, &vfd_due);
+  return (usec > 0) ? usec : attente;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* End current frame wait (new title, new order...). Any thread. */
+static void app_wake(void)
+{
+  pthread_mutex_lock(&vfd_alerts_lock);
+  vfd_wakeups++;
+  pthread_cond_signal(&vfd_alerts_cond);
+  pthread_mutex_unlock(&vfd_alerts_lock);
+}
+
+
+/* Queue a one-shot order, it preempts running order if its priority is
+ * higher. Can be called from any thread. */
+static int app_post_order(handler_t *req)
+{
+  handler_t *p;
+
+  pthread_mutex_lock(&vfd_alerts_lock);
+  req->state = ORDER_IDLE;
+  p = handler_add(&vfd_alerts, req);
+  pthread_mutex_unlock(&vfd_alerts_lock);
+
+  if (p == NULL) {
+    fprintf(stderr, "err: can't add handler\n");
+    return -1;
+  }
+
+  app_wake();
   return 0;
 }
 
 
+/* New line in the alerts file: scrolled once over any other order. A newer
+ * alert replaces the pending (or shown) one. Checked at every frame. */
+static void app_alerts(void)
+{
+  handler_t req, *p;
+  int i, n;
+
+  if (!vfd_alert_watch || !tail_update(&vfd_alert_file) ||
+      vfd_alert_file.line[0] == 0)
+    return;
+
+  fprintf(stderr, "dbg: alert: %s\n", vfd_alert_file.line);
+  strcpy(vfd_alert_text, vfd_alert_file.line);
+
+  pthread_mutex_lock(&vfd_alerts_lock);
+  n = handler_count(&vfd_alerts);
+  for (i = 0; i < n; i++) {
+    p = handler_get(&vfd_alerts, i);
+    if (p->command == ORDER_HANDLER_MESSAGE &&
+        p->data.text.message == vfd_alert_text) {
+      p->state = ORDER_IDLE; // start again with new text
+      break;
+    }
+  }
+  pthread_mutex_unlock(&vfd_alerts_lock);
+
+  if (i < n)
+    return;
+
+  memset(&req, 0, sizeof(req));
+  req.command = ORDER_HANDLER_MESSAGE;
+  req.priority = ORDER_PRIORITY_ALERT;
+  req.cb = cb_text;
+  req.data.text.message = vfd_alert_text;
+  req.data.text.style = 0;
+  app_post_order(&req);
+}
+
+
+/* Sleep until deadline, or until an order is posted (returns 1) */
+static int app_wait(const struct timespec *deadline, long posted)
+{
+  int woken;
+
+  pthread_mutex_lock(&vfd_alerts_lock);
+  while (vfd_wakeups == posted && !quit) {
+    if (pthread_cond_timedwait(&vfd_alerts_cond, &vfd_alerts_lock,
+          deadline) == ETIMEDOUT)
+      break;
+  }
+  woken = (vfd_wakeups != posted);
+  pthread_mutex_unlock(&vfd_alerts_lock);
+
+  return woken;
+}
+
+
+
+/* Take graph samples due by the frame being rendered now, whatever order
+ * is shown. Lowers *wake (if not NULL) to the next sample. */
+static void app_sample(struct timespec *wake)
+{
+  struct timespec now, t;
+  handler_t *p;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  usec_add(&now, FB_RENDER_AHEAD_USEC);
+
+  for (i = 0; i < handler_count(&vfd_orders); i++) {
+    p = handler_get(&vfd_orders, i);
+    if (p->command != ORDER_HANDLER_GRAPH)
+      continue;
+
+    graph_sample(&p->data.graph.graph, &now);
+
+    t = p->data.graph.graph.next;
+    usec_add(&t, -FB_RENDER_AHEAD_USEC);
+    if (wake != NULL && usec_diff(&t, wake) < 0)
+      *wake = t;
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Remote control: skip to next blocking order, or show date/time */
+static void ir_key(unsigned long scancode, int keycode, int pressed, void *data)
+{
+  handler_t req;
+
+  if (pressed != 1)
+    return;
+
+  fprintf(stderr, "dbg: IR key %d (0x%08lx)\n", keycode, scancode);
+
+  if (keycode == KEY_NEXT)
+    next_order = 1;
+  else if (keycode == KEY_OK) {
+    memset(&req, 0, sizeof(req));
+    req.command = ORDER_HANDLER_CLOCK;
+    req.priority = ORDER_PRIORITY_ALERT;
+    req.cb = cb_date_and_time;
+    req.data.clock.frames = 5;
+    app_post_order(&req);
+  }
+}
+
+
+static void ir_log(unsigned long scancode, int keycode, int pressed, void *data)
+{
+  static const char *states[] = { "released", "pressed", "repeat" };
+
+  fprintf(stderr, "dbg: IR key %d %s (0x%08lx)\n", keycode, states[pressed],
+      scancode);
+}
+
 /* ------------------------------------------------------------------------- */
 
 
@@ -220,12 +581,29 @@ static void help(void)
       "   -c, --clean           Clean display and icons\n"
       "       --clock           Build-in Cypress feature\n"
       "       --test            Display all icons and fill with text\n"
+      "       --stdin           Read commands from standard input, one per line:\n"
+      "                         text STRING, center STRING, icons [LIST], clear, clock\n"
       "\n"
       "Blocking orders:\n"
       "   -t, --time            Display date/time\n"
       "       --msg=STRING      Display message (circular scrolling)\n"
       "       --msg2=STRING     Display message (per page)\n"
       "       --msg_uptime      Display system infos\n"
+      "       --tail=FILE       Display newest line of FILE (follows rotation)\n"
+      "       --graph=WHAT[,bar] Activity history of cpu, net or disk. With bar,\n"
+      "                         last sample is shown on volume icons too\n"
+      "       --alerts=FILE     Lines appended to FILE scroll once, over any\n"
+      "                         other order\n"
+      "\n"
+      "Remote control:\n"
+      "       --ir              Forward IR receiver keys to a virtual keyboard\n"
+      "       --ir-replay=FILE  Same, reading recorded reports from FILE.\n"
+      "                         Works without display (keys are logged)\n"
+      "       --ir-keymap=FILE  Scancode to key mapping (none by default)\n"
+      "\n"
+      "System monitoring:\n"
+      "       --mixer[=CARD]    Mirror master volume on icons (CARD: default)\n"
+      "       --mpris[=PLAYER]  Media player title and play/pause/stop icons\n"
       "\n"
       "Misc options:\n"
       "  -h,  --help            display this help and exit\n"
@@ -270,10 +648,220 @@ static unsigned long parse_icons(const char *text)
   return ret;
 }
 
+/* ------------------------------------------------------------------------- */
+
+enum stdin_commands {
+  STDIN_NONE,
+  STDIN_TEXT,
+  STDIN_CENTER,
+  STDIN_ICONS,
+  STDIN_CLEAR,
+  STDIN_CLOCK
+};
+
+/* Commands of the same class supersede each other */
+static int stdin_class(int cmd)
+{
+  return (cmd == STDIN_CENTER || cmd == STDIN_CLOCK) ? STDIN_TEXT : cmd;
+}
+
+
+static int stdin_parse(char *line, char **arg)
+{
+  static const struct {
+    const char *name;
+    int cmd;
+  } commands[] = {
+    { "text",   STDIN_TEXT },
+    { "center", STDIN_CENTER },
+    { "icons",  STDIN_ICONS },
+    { "clear",  STDIN_CLEAR },
+    { "clock",  STDIN_CLOCK }
+  };
+
+  char *p;
+  int i;
+
+  *arg = NULL;
+  if ((p = strchr(line, ' ')) != NULL) {
+    *p = 0;
+    *arg = p + 1;
+  }
+
+  for (i = 0; i < sizeof(commands)/sizeof(commands[0]); i++) {
+    if (strcmp(line, commands[i].name) == 0)
+      return commands[i].cmd;
+  }
+
+  if (line[0] != 0)
+    fprintf(stderr, "wrn: unknown command %s, ignoring\n", line);
+  return STDIN_NONE;
+}
+
+
+static void stdin_apply(int cmd, char *arg)
+{
+  switch (cmd) {
+    case STDIN_TEXT:
+      app_display_text((arg == NULL) ? "" : arg);
+      break;
+    case STDIN_CENTER:
+      app_display_centered_text((arg == NULL) ? "" : arg);
+      break;
+    case STDIN_ICONS:
+      vfd_display_icons(vfd, (arg == NULL) ? 0 : parse_icons(arg));
+      break;
+    case STDIN_CLEAR:
+      vfd_clear(vfd, 0);
+      break;
+    case STDIN_CLOCK:
+      vfd_display_clock(vfd);
+      break;
+  }
+}
+
+
+/* Streaming mode: keep the device open and apply commands read from stdin.
+ * All pending input is read before drawing, so when commands arrive faster
+ * than the panel can draw, superseded ones are dropped: only the last
+ * text (or clock) and the last icons since the last clear are applied. */
+static int app_stdin(void)
+{
+  static char in[STDIN_BUFFER_SZ];
+  char *args[STDIN_BATCH], *p, *e;
+  int cmds[STDIN_BATCH];
+  struct pollfd pfd;
+  int used = 0, eof = 0, skip = 0, n, nb, i, j;
+  long dropped = 0;
+
+  pfd.fd = STDIN_FILENO;
+  pfd.events = POLLIN;
+
+  while (!quit) {
+    /* Wait for input only when no complete line is pending */
+    n = (memchr(in, '\n', used) != NULL) ? 0 : -1;
+    if (eof && n < 0)
+      break;
+
+    if (!eof && used < STDIN_BUFFER_SZ && poll(&pfd, 1, n) > 0) {
+      n = read(STDIN_FILENO, in + used, STDIN_BUFFER_SZ - used);
+      if (n > 0 && skip) {
+        // rest of a too long line
+        if ((p = memchr(in, '\n', n)) != NULL) {
+          skip = 0;
+          used = in + n - (p + 1);
+          memmove(in, p + 1, used);
+        }
+      } else if (n > 0)
+        used += n;
+      else if (n == 0) {
+        eof = 1;
+        if (used > 0 && in[used - 1] != '\n' && used < STDIN_BUFFER_SZ)
+          in[used++] = '\n';
+      }
+      continue;
+    }
+
+    if (memchr(in, '\n', used) == NULL) {
+      if (used == STDIN_BUFFER_SZ) {
+        fprintf(stderr, "wrn: line too long, ignoring\n");
+        used = 0;
+        skip = 1;
+      }
+      continue;
+    }
+
+    /* Split complete lines */
+    for (nb = 0, p = in; nb < STDIN_BATCH &&
+        (e = memchr(p, '\n', in + used - p)) != NULL; p = e + 1) {
+      *e = 0;
+      if (e > p && e[-1] == '\r')
+        e[-1] = 0;
+      cmds[nb] = stdin_parse(p, &args[nb]);
+      if (cmds[nb] != STDIN_NONE)
+        nb++;
+    }
+
+    /* Apply in order, skipping superseded commands */
+    for (i = 0; i < nb && !quit; i++) {
+      for (j = i + 1; j < nb; j++) {
+        if (cmds[j] == STDIN_CLEAR || stdin_class(cmds[j]) == stdin_class(cmds[i]))
+          break;
+      }
+      if (j < nb)
+        dropped++;
+      else
+        stdin_apply(cmds[i], args[i]);
+    }
+
+    used -= p - in;
+    memmove(in, p, used);
+  }
+
+  if (dropped > 0)
+    fprintf(stderr, "dbg: %ld command(s) coalesced\n", dropped);
+
+  return 0;
+}
+
+
+/* Without display, IR replay still runs (testing without hardware): keys
+ * are just logged. Other options are ignored. */
+static int app_ir_only(int argc, char *argv[], const char *short_options,
+    const struct option *long_options)
+{
+  char *replay = NULL, *keymap = NULL;
+  ir_transport_t t;
+  int c;
+
+  opterr = 0;
+  while ((c = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+    if (c == 'R')
+      replay = optarg;
+    else if (c == 'K')
+      keymap = optarg;
+  }
+
+  if (replay == NULL)
+    return 0;
+
+  fprintf(stderr, "dbg: no display, replaying IR reports only\n");
+
+  if (keymap != NULL && ir_load_keymap(keymap) < 0)
+    return -1;
+  if (ir_transport_replay(&t, replay) != 0)
+    return -1;
+
+  ir_register_callback(ir_log, NULL);
+  if (ir_start(&t) != 0)
+    return -1;
+
+  signal(SIGINT,  sig_int);
+  signal(SIGTERM, sig_int);
+  signal(SIGQUIT, sig_int);
+
+  while (!quit && ir_active())
+    usleep(100000);
+
+  ir_stop();
+  return 0;
+}
+
 
 int main(int argc, char *argv[])
 {
-  int c, ret;
+  int c, i, ret;
+  handler_t *pReq;
+  int ir = 0;
+  int use_stdin = 0;
+  char *ir_replay = NULL;
+  char *ir_keymap = NULL;
+  char *mixer = NULL;
+  int graph_bar = 0;
+#ifdef HAVE_DBUS
+  int mpris = 0;
+  char *mpris_player = NULL;
+#endif
   int option_index = 0;  /* getopt_long stores the option index here. */
 
   static char short_options[] = "hcm:i:t";
@@ -282,12 +870,21 @@ int main(int argc, char *argv[])
     {"icons",   optional_argument, NULL, 'i'},
     {"clean",   no_argument, 0, 'c' },
     {"test",    no_argument, 0, 'e' },
+    {"stdin",   no_argument, 0, 'S' },
     {"vol",     required_argument, 0, 'o'},
     {"msg",     required_argument, 0, 'n'},
     {"msg2",    required_argument, 0, 'q'},
     {"msg_uptime", no_argument, 0, 'p' },
+    {"tail",    required_argument, 0, 'T' },
+    {"graph",   required_argument, 0, 'G' },
+    {"alerts",  required_argument, 0, 'A' },
     {"clock",   no_argument, 0, 'b' },
     {"time",    no_argument, 0, 't' },
+    {"ir",      no_argument, 0, 'r' },
+    {"ir-replay", required_argument, 0, 'R' },
+    {"ir-keymap", required_argument, 0, 'K' },
+    {"mixer",   optional_argument, 0, 'x' },
+    {"mpris",   optional_argument, 0, 'y' },
     {"version", no_argument, 0, 'v' },
     {"help",    no_argument, 0, 'h' },
     {0, 0, 0, 0}
@@ -297,14 +894,26 @@ int main(int argc, char *argv[])
   setlocale(LC_TIME, "fr_FR.UTF-8");
 
   handler_init(&vfd_orders);
+  handler_init(&vfd_alerts);
+  {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&vfd_alerts_cond, &attr);
+    pthread_condattr_destroy(&attr);
+  }
 
-  ret = vfd_init(SHUTTLE_VFD_VENDOR_ID, SHUTTLE_VFD_PRODUCT_ID,
+  vfd = vfd_open(SHUTTLE_VFD_VENDOR_ID, SHUTTLE_VFD_PRODUCT_ID,
       SHUTTLE_VFD_INTERFACE_NUM);
 
-  if (ret == 0) {
+  if (vfd != NULL) {
     handler_t req;
 
+    fb_init(vfd);
+
     while ((c = getopt_long(argc, argv, short_options, long_options, &option_index)) != -1) {
+      memset(&req, 0, sizeof(req));
+
       switch(c) {
 
         /* Generic options */
@@ -321,32 +930,30 @@ int main(int argc, char *argv[])
 
         /* Non blocking requests */
         case 'c':
-          vfd_clear(0);
+          vfd_clear(vfd, 0);
           break;
         case 'm':
           app_display_text(optarg);
           break;
         case 'i':
           if (optarg == NULL)
-            vfd_display_icons(0);
+            vfd_display_icons(vfd, 0);
           else
-            vfd_display_icons(parse_icons(optarg));
+            vfd_display_icons(vfd, parse_icons(optarg));
           break;
         case 'e':
           app_display_text(TEST_STRING);
-          vfd_display_icons(SHUTTLE_VFD_ALL_ICONS);
+          vfd_display_icons(vfd, SHUTTLE_VFD_ALL_ICONS);
           break;
         case 'o':
           parse_number(optarg, &ret);
-          if (ret == 0)
-            vfd_display_icons(SHUTTLE_VFD_ICON_MUTE);
-          else {
-            if (ret > 100) ret = 100;
-            vfd_display_icons((3*ret/25+1) << 15);
-          }
+          vfd_display_icons(vfd, vfd_volume_icons(ret));
           break;
         case 'b':
-          vfd_display_clock();
+          vfd_display_clock(vfd);
+          break;
+        case 'S':
+          use_stdin = 1;
           break;
 
         /* Blocking requests */
@@ -389,13 +996,138 @@ int main(int argc, char *argv[])
             fprintf(stderr, "err: can't add handler\n");
           break;
 
+        case 'T':
+          req.command = ORDER_HANDLER_TAIL;
+          req.cb = cb_tail;
+          req.data.tail.frame = vfd_frame - 1;
+          if (tail_open(&req.data.tail.tail, optarg) < 0)
+            break;
+
+          if (handler_add(&vfd_orders, &req) == NULL) {
+            fprintf(stderr, "err: can't add handler\n");
+            tail_close(&req.data.tail.tail);
+          }
+          break;
+
+        case 'G':
+          req.command = ORDER_HANDLER_GRAPH;
+          req.cb = cb_graph;
+          req.data.graph.frame = vfd_frame - 1;
+          if (graph_init(&req.data.graph.graph, optarg) < 0)
+            break;
+          if (req.data.graph.graph.bar)
+            graph_bar = 1;
+
+          if (handler_add(&vfd_orders, &req) == NULL)
+            fprintf(stderr, "err: can't add handler\n");
+          break;
+
+        case 'A':
+          if (vfd_alert_watch) {
+            fprintf(stderr, "wrn: only one alerts file can be watched\n");
+            break;
+          }
+          if (tail_open(&vfd_alert_file, optarg) < 0)
+            break;
+          // only lines written from now on are alerts
+          vfd_alert_file.line[0] = 0;
+          vfd_alert_watch = 1;
+          break;
+
+        /* Remote control */
+        case 'r':
+          ir = 1;
+          break;
+        case 'R':
+          ir = 1;
+          ir_replay = optarg;
+          break;
+        case 'K':
+          ir_keymap = optarg;
+          break;
+
+        /* System monitoring */
+        case 'x':
+          mixer = (optarg == NULL) ? ALSA_VOLUME_CARD : optarg;
+          break;
+        case 'y':
+#ifdef HAVE_DBUS
+          if (mpris) {
+            fprintf(stderr, "wrn: only one player can be followed\n");
+            break;
+          }
+          req.command = ORDER_HANDLER_NOW_PLAYING;
+          req.cb = cb_now_playing;
+          req.data.player.player = optarg;
+          req.data.player.gen = -1;
+
+          if (handler_add(&vfd_orders, &req) == NULL)
+            fprintf(stderr, "err: can't add handler\n");
+          else {
+            mpris = 1;
+            mpris_player = optarg;
+          }
+#else
+          fprintf(stderr, "err: built without D-Bus support (make DBUS=1)\n");
+#endif
+          break;
+
       }
     } //while
 
+    if (ir) {
+      ir_transport_t t;
+
+      if (ir_replay != NULL)
+        ret = ir_transport_replay(&t, ir_replay);
+      else
+        ret = ir_transport_usb(&t, vfd);
+
+      if (ret == 0 && ir_keymap != NULL && ir_load_keymap(ir_keymap) < 0)
+        ret = -1;
+
+      if (ret == 0) {
+        ir_register_callback(ir_key, NULL);
+        ir_uinput_open(PROGRAM_NAME " remote");
+        ret = ir_start(&t);
+      }
+      if (ret != 0)
+        ir = 0;
+    }
+
+    if (mixer != NULL && graph_bar)
+      fprintf(stderr, "wrn: mixer and graph bar share the volume icons\n");
+
+    if (mixer != NULL) {
+#ifdef HAVE_ALSA
+      if (alsa_volume_start(vfd, mixer, ALSA_VOLUME_ELEM) != 0)
+        mixer = NULL;
+#else
+      fprintf(stderr, "err: built without ALSA support (make ALSA=1)\n");
+      mixer = NULL;
+#endif
+    }
+
+    if (use_stdin) {
+      signal(SIGINT,  sig_int);
+      signal(SIGTERM, sig_int);
+      signal(SIGQUIT, sig_int);
+
+      app_stdin();
+    }
+
+#ifdef HAVE_DBUS
+    if (mpris && mpris_start(vfd, mpris_player, app_wake) != 0)
+      mpris = 0;
+#endif
+
     /* If we have blocking requests, treat them */
-    if (handler_count(&vfd_orders) > 0) {
-      int i;
-      handler_t *pReq;
+    if (handler_count(&vfd_orders) > 0 || ir || mixer != NULL ||
+        vfd_alert_watch) {
+      int delay;
+      long rr = 0, posted;
+      handler_t *cur = NULL;
+      struct timespec now, wake, t;
 
       fprintf(stderr, "dbg: processing orders\n");
 
@@ -404,29 +1136,118 @@ int main(int argc, char *argv[])
       signal(SIGTERM, sig_int);
       signal(SIGQUIT, sig_int);
 
+      /* One frame per iteration. Command line orders are played in turn,
+       * a posted order with higher priority takes over at frame boundary.
+       * Interrupted order keeps its state and resumes afterwards.
+       * Frames are rendered FB_RENDER_AHEAD_USEC before their deadline
+       * (vfd_due): the sender thread starts transmitting FB_SEND_USEC
+       * before it, so text is fully shown at vfd_due. */
+      fb_start();
+      clock_gettime(CLOCK_MONOTONIC, &vfd_due);
+
       while (!quit) {
 
-        for (i = 0; i < handler_count(&vfd_orders); i++) {
-          pReq = handler_get(&vfd_orders, i);
+        app_alerts();
+
+        pthread_mutex_lock(&vfd_alerts_lock);
+        posted = vfd_wakeups;
+
+        if (cur == NULL && handler_count(&vfd_orders) > 0)
+          cur = handler_get(&vfd_orders, rr % handler_count(&vfd_orders));
+
+        pReq = cur;
+        for (i = 0; i < handler_count(&vfd_alerts); i++) {
+          handler_t *a = handler_get(&vfd_alerts, i);
+          if (pReq == NULL || a->priority > pReq->priority)
+            pReq = a;
+        }
+        pthread_mutex_unlock(&vfd_alerts_lock);
+
+        if (cur != NULL && pReq != cur && cur->state == ORDER_RUNNING)
+          cur->state = ORDER_PREEMPTED;
+        cur = pReq;
 
-          switch (pReq->command) {
+        app_sample(NULL);
+
+        delay = 0;
+        if (cur != NULL && !next_order) {
+          switch (cur->command) {
             case ORDER_HANDLER_CLOCK:
             case ORDER_HANDLER_MESSAGE:
             case ORDER_HANDLER_MESSAGE_UPTIME:
-              pReq->cb(&req.data);
+            case ORDER_HANDLER_NOW_PLAYING:
+            case ORDER_HANDLER_TAIL:
+            case ORDER_HANDLER_GRAPH:
+              delay = cur->cb(cur);
               break;
 
             default:
               fprintf(stderr, "err: unknow order handler\n");
           }
+        }
 
-        } // foreach handler
-        usleep(attente);
+        /* End of pass (or skipped): next order */
+        if (cur != NULL && delay == 0) {
+          cur->state = ORDER_IDLE;
 
+          pthread_mutex_lock(&vfd_alerts_lock);
+          for (i = 0; i < handler_count(&vfd_alerts); i++) {
+            if (handler_get(&vfd_alerts, i) == cur)
+              break;
+          }
+          if (i < handler_count(&vfd_alerts))
+            handler_remove(&vfd_alerts, i);
+          else
+            rr++;
+          pthread_mutex_unlock(&vfd_alerts_lock);
+
+          cur = NULL;
+          next_order = 0;
+          continue;
+        }
+
+        usec_add(&vfd_due, (cur == NULL) ? attente : delay);
+        wake = vfd_due;
+        usec_add(&wake, -FB_RENDER_AHEAD_USEC);
+
+        /* Wake up for graph samples meanwhile */
+        do {
+          t = wake;
+          app_sample(&t);
+          ret = app_wait(&t, posted);
+        } while (!ret && usec_diff(&wake, &t) > 0);
+
+        /* Posted order (or late): render for now */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (ret || usec_diff(&vfd_due, &now) < 0)
+          vfd_due = now;
       }
+
+      fb_stop();
     }
 
-    vfd_close(SHUTTLE_VFD_INTERFACE_NUM);
+    for (i = 0; i < handler_count(&vfd_orders); i++) {
+      pReq = handler_get(&vfd_orders, i);
+      if (pReq->command == ORDER_HANDLER_TAIL)
+        tail_close(&pReq->data.tail.tail);
+    }
+    if (vfd_alert_watch)
+      tail_close(&vfd_alert_file);
+
+    if (ir)
+      ir_stop();
+#ifdef HAVE_ALSA
+    if (mixer != NULL)
+      alsa_volume_stop();
+#endif
+#ifdef HAVE_DBUS
+    if (mpris)
+      mpris_stop();
+#endif
+
+    vfd_close(vfd);
+  } else {
+    return app_ir_only(argc, argv, short_options, long_options);
   }
 
   return 0;